@@ -0,0 +1,425 @@
+/* 20210741 김소현 */
+/* sooohyun@postech.ac.kr*/
+
+/*
+ * csim-bench - throughput benchmark for csim on synthetic traces
+ *
+ *   gcc -g -Wall -Werror -std=c99 -m64 -O2 -o csim-bench csim-bench.c -lm
+ *   ./csim-bench [-c <csim>] [-n <accesses>] [-s <s>] [-E <E>] [-b <b>] [-r <repeats>]
+ *                [-B <baseline>] [-W <baseline>] [-T <tolerance %>]
+ *
+ * Writes sequential, strided, random, zipfian and pointer-chasing traces
+ * over 16KB, 1MB and 64MB working sets, runs `csim -r` on each (best of
+ * -r runs) and prints wall time, csim's parse / simulate split, accesses
+ * per second and ns per access. -W saves the rates as a baseline file;
+ * -B compares against one and exits 1 if any workload got more than
+ * -T percent slower.
+ *
+ * Rates only compare on the host that wrote them, so no baseline is kept
+ * in the tree: run -W on the old csim, then -B with the new one. Back to
+ * back runs of one binary have differed by up to 40% on a shared host,
+ * hence the default -T of 50; on a quiet machine a tighter -T works.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+
+
+enum { SEQUENTIAL, STRIDED, RANDOM, ZIPF, CHASE, PATTERN_COUNT };
+
+static const char* pattern_names[] = { "seq", "stride", "random", "zipf", "chase" };
+
+static const unsigned long long sizes[] = { 16 << 10, 1 << 20, 64 << 20 };
+static const char* size_names[] = { "16K", "1M", "64M" };
+
+#define SIZE_COUNT 3
+#define WORKLOADS (PATTERN_COUNT * SIZE_COUNT)
+#define BASE 0x7f0000000000ULL
+#define LINE 64       // generator block size, independent of csim's -b
+#define STRIDE 264    // bytes, not a power of two so it walks across sets
+#define ZIPF_THETA 0.99
+
+
+
+// one workload's measurements, the fastest of the repeats
+typedef struct
+{
+    char name[32];
+    unsigned long long accesses;
+    double wall;     // fork to exit, includes mapping the trace
+    double time;     // csim -r: parse + simulate
+    double parse;
+    double simulate;
+    double rate;     // accesses per second over `time`
+} result;
+
+
+
+static unsigned long long rng_state = 0x9e3779b97f4a7c15ULL;
+
+static unsigned long long next_random(void)
+
+{
+
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+
+
+static double random_unit(void)
+
+{
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+
+static double now_sec(void)
+
+{
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+
+// zipfian block ranks (Gray et al., "Quickly generating billion-record
+// synthetic databases"), scrambled so the hot blocks do not share a set
+typedef struct
+{
+    unsigned long long n;
+    double alpha;
+    double zetan;
+    double eta;
+    double half_pow;
+} zipf;
+
+
+
+static void init_zipf(zipf* z, unsigned long long n)
+
+{
+
+    double zeta2 = 1 + pow(0.5, ZIPF_THETA);
+
+    z->n = n;
+    z->zetan = 0;
+    for (unsigned long long i = 1; i <= n; i++)
+        z->zetan += 1 / pow((double)i, ZIPF_THETA);
+    z->alpha = 1 / (1 - ZIPF_THETA);
+    z->eta = (1 - pow(2.0 / n, 1 - ZIPF_THETA)) / (1 - zeta2 / z->zetan);
+    z->half_pow = 1 + pow(0.5, ZIPF_THETA);
+}
+
+
+
+static unsigned long long next_zipf(zipf* z)
+
+{
+
+    double u = random_unit();
+    double uz = u * z->zetan;
+    unsigned long long rank;
+
+    if (uz < 1)
+        rank = 0;
+    else if (uz < z->half_pow)
+        rank = 1;
+    else
+        rank = (unsigned long long)(z->n * pow(z->eta * u - z->eta + 1, z->alpha));
+    if (rank >= z->n)
+        rank = z->n - 1;
+    return (rank * 0x9e3779b97f4a7c15ULL) % z->n;
+}
+
+
+
+// write `n` records of one pattern over a `bytes` working set; every
+// fourth access is a store
+static int generate(FILE* out, int pattern, unsigned long long bytes, unsigned long long n)
+
+{
+
+    unsigned long long blocks = bytes / LINE;
+    unsigned long long* next = 0;
+    unsigned long long cur = 0;
+    zipf z = {};
+
+    if (pattern == ZIPF)
+        init_zipf(&z, blocks);
+
+    if (pattern == CHASE)
+    {
+        // Sattolo's shuffle: one cycle through every block
+        if (!(next = malloc(blocks * sizeof(unsigned long long))))
+            return 1;
+        for (unsigned long long i = 0; i < blocks; i++)
+            next[i] = i;
+        for (unsigned long long i = blocks - 1; i > 0; i--)
+        {
+            unsigned long long j = next_random() % i;
+            unsigned long long t = next[i];
+            next[i] = next[j];
+            next[j] = t;
+        }
+    }
+
+    for (unsigned long long i = 0; i < n; i++)
+
+    {
+        unsigned long long offset;
+
+        switch (pattern)
+        {
+        case SEQUENTIAL:
+            offset = i * 8 % bytes;
+            break;
+        case STRIDED:
+            offset = i * STRIDE % bytes;
+            break;
+        case RANDOM:
+            offset = next_random() % bytes & ~7ULL;
+            break;
+        case ZIPF:
+            offset = next_zipf(&z) * LINE + (next_random() & 7) * 8;
+            break;
+        default:
+            offset = cur * LINE;
+            cur = next[cur];
+            break;
+        }
+        fprintf(out, " %c %llx,8\n", i % 4 == 3 ? 'S' : 'L', BASE + offset);
+    }
+
+    free(next);
+    return ferror(out);
+}
+
+
+
+// run `csim -r` on one trace and read its report line from stderr
+static int run_csim(const char* csim, const char* geometry[3], const char* path, result* r)
+
+{
+
+    int fds[2];
+    char report[512];
+    size_t length = 0;
+    ssize_t n;
+    int status;
+
+    if (pipe(fds))
+        return 1;
+
+    double start = now_sec();
+    pid_t pid = fork();
+
+    if (pid < 0)
+        return 1;
+
+    if (!pid)
+    {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        execl(csim, csim, "-r", "-s", geometry[0], "-E", geometry[1], "-b", geometry[2],
+              "-t", path, (char*)0);
+        _exit(127);
+    }
+
+    close(fds[1]);
+    while ((n = read(fds[0], report + length, sizeof(report) - 1 - length)) > 0)
+        length += n;
+    close(fds[0]);
+    report[length] = 0;
+
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+        return 1;
+    r->wall = now_sec() - start;
+
+    if (sscanf(report, "accesses:%llu time:%lfs rate:%lf accesses/sec parse:%lfs simulate:%lfs",
+               &r->accesses, &r->time, &r->rate, &r->parse, &r->simulate) != 5)
+        return 1;
+    return 0;
+}
+
+
+
+// baseline files hold "<workload> <accesses/sec>" lines; returns 0 if absent
+static double baseline_rate(FILE* baseline, const char* name)
+
+{
+
+    char line[128];
+    char key[32];
+    double rate;
+
+    if (!baseline)
+        return 0;
+
+    rewind(baseline);
+    while (fgets(line, sizeof(line), baseline))
+        if (line[0] != '#' && sscanf(line, "%31s %lf", key, &rate) == 2 && !strcmp(key, name))
+            return rate;
+    return 0;
+}
+
+
+
+int main(int argc, char* argv[])
+
+{
+
+    const char* csim = "./csim";
+    const char* geometry[3] = { "8", "8", "6" };
+    unsigned long long n = 1000000;
+    int repeats = 5;
+    const char* baseline_path = 0;
+    const char* save_path = 0;
+    double tolerance = 50;
+    result results[WORKLOADS];
+    int regressions = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:s:E:b:r:B:W:T:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            csim = optarg;
+            break;
+        case 'n':
+            n = strtoull(optarg, 0, 10);
+            break;
+        case 's':
+            geometry[0] = optarg;
+            break;
+        case 'E':
+            geometry[1] = optarg;
+            break;
+        case 'b':
+            geometry[2] = optarg;
+            break;
+        case 'r':
+            repeats = atoi(optarg);
+            break;
+        case 'B':
+            baseline_path = optarg;
+            break;
+        case 'W':
+            save_path = optarg;
+            break;
+        case 'T':
+            tolerance = atof(optarg);
+            break;
+        case 'h':
+            printf("Usage: ./csim-bench [-c <csim>] [-n <accesses>] [-s <s>] [-E <E>] [-b <b>]"
+                   " [-r <repeats>] [-B <baseline>] [-W <baseline>] [-T <tolerance %%>]\n");
+            return 0;
+        default:
+            return 1;
+        }
+    }
+
+    if (!n || repeats < 1)
+        return 1;
+
+    FILE* baseline = baseline_path ? fopen(baseline_path, "r") : 0;
+    if (baseline_path && !baseline)
+        return 1;
+
+    printf("%-12s %10s %8s %8s %8s %9s %8s %9s\n", "workload", "accesses", "wall", "parse",
+           "simulate", "Macc/s", "ns/acc", "baseline");
+
+    for (int w = 0; w < WORKLOADS; w++)
+
+    {
+        int pattern = w / SIZE_COUNT;
+        int size = w % SIZE_COUNT;
+        result* best = &results[w];
+        char path[] = "/tmp/csim-bench-XXXXXX";
+        int fd = mkstemp(path);
+        FILE* out = fd < 0 ? 0 : fdopen(fd, "w");
+
+        if (!out)
+            return 1;
+        int failed = generate(out, pattern, sizes[size], n);
+        if (fclose(out) || failed)
+        {
+            unlink(path);
+            return 1;
+        }
+
+        memset(best, 0, sizeof(result));
+        for (int k = 0; k < repeats; k++)
+        {
+            result r = {};
+            if (run_csim(csim, geometry, path, &r))
+            {
+                fprintf(stderr, "%s failed on %s-%s\n", csim, pattern_names[pattern],
+                        size_names[size]);
+                unlink(path);
+                return 1;
+            }
+            if (!k || r.time < best->time)
+                *best = r;
+        }
+        unlink(path);
+        snprintf(best->name, sizeof(best->name), "%s-%s", pattern_names[pattern],
+                 size_names[size]);
+
+        double ns = best->accesses ? best->time * 1e9 / best->accesses : 0;
+        double base = baseline_rate(baseline, best->name);
+        char change[32] = "-";
+
+        if (base > 0)
+        {
+            double delta = 100 * (best->rate - base) / base;
+            int slower = delta < -tolerance;
+            snprintf(change, sizeof(change), "%+.1f%%%s", delta, slower ? " SLOWER" : "");
+            regressions += slower;
+        }
+
+        printf("%-12s %10llu %7.3fs %7.3fs %7.3fs %9.2f %8.1f %9s\n", best->name,
+               best->accesses, best->wall, best->parse, best->simulate, best->rate / 1e6, ns,
+               change);
+        fflush(stdout);
+    }
+
+    if (baseline)
+        fclose(baseline);
+
+    if (save_path)
+    {
+        FILE* save = fopen(save_path, "w");
+        if (!save)
+            return 1;
+        fprintf(save, "# csim-bench baseline: <workload> <accesses/sec>, -n %llu -s %s -E %s"
+                " -b %s\n", n, geometry[0], geometry[1], geometry[2]);
+        for (int w = 0; w < WORKLOADS; w++)
+            fprintf(save, "%s %.0f\n", results[w].name, results[w].rate);
+        if (fclose(save))
+            return 1;
+    }
+
+    if (regressions)
+        printf("%d workload(s) more than %.0f%% slower than the baseline\n", regressions,
+               tolerance);
+    return regressions > 0;
+}
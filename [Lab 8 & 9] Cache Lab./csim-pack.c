@@ -0,0 +1,213 @@
+/* 20210741 김소현 */
+/* sooohyun@postech.ac.kr*/
+
+/*
+ * csim-pack - convert valgrind text traces to the csim binary format
+ *
+ *   ./csim-pack [-d] <input> <output>      ("-" for stdin / stdout)
+ *
+ * -d converts a binary trace back to text. See csim.h for the format;
+ * thread ids are dropped.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "csim.h"
+
+
+
+typedef struct
+{
+    int sizes[TRACE_SIZE_NEW];
+    int count;
+} size_dict;
+
+
+
+static const char op_chars[] = "LSMI";
+
+
+
+void put_varint(FILE* out, unsigned long long v)
+
+{
+
+    while (v >= 0x80)
+    {
+        putc((int)(v & 0x7f) | 0x80, out);
+        v >>= 7;
+    }
+    putc((int)v, out);
+}
+
+
+
+int get_varint(FILE* in, unsigned long long* v)
+
+{
+
+    int c;
+    int shift = 0;
+
+    *v = 0;
+    while ((c = getc(in)) != EOF)
+    {
+        *v |= (unsigned long long)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return 1;
+        shift += 7;
+        if (shift > 63)
+            return 0;
+    }
+    return 0;
+}
+
+
+
+int pack(FILE* in, FILE* out)
+
+{
+
+    size_dict dict = {};
+    unsigned long long prev = 0;
+    unsigned long long records = 0;
+    unsigned long long threaded = 0;
+    char line[256];
+
+    fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_LEN, out);
+
+    while (fgets(line, sizeof(line), in))
+
+    {
+        char* p = line;
+        char* end;
+
+        while (*p == ' ' || *p == '\t')
+            p++;
+
+        const char* op = *p ? strchr(op_chars, *p) : 0;
+        if (!op)
+            continue;
+
+        unsigned long long address = strtoull(p + 1, &end, 16);
+        int size = *end == ',' ? atoi(end + 1) : 0;
+        if (*end == ',' && strchr(end + 1, ','))
+            threaded++;
+        int code = 0;
+
+        while (code < dict.count && dict.sizes[code] != size)
+            code++;
+        if (code == dict.count)
+        {
+            code = TRACE_SIZE_NEW;
+            if (dict.count < TRACE_SIZE_NEW)
+                dict.sizes[dict.count++] = size;
+        }
+
+        putc((int)(op - op_chars) << 6 | code, out);
+        if (code == TRACE_SIZE_NEW)
+            put_varint(out, (unsigned)size);
+
+        long long delta = (long long)(address - prev);
+        put_varint(out, ((unsigned long long)delta << 1) ^ (unsigned long long)(delta >> 63));
+        prev = address;
+        records++;
+    }
+
+    fprintf(stderr, "packed %llu records\n", records);
+    if (threaded)
+        fprintf(stderr, "dropped the thread ids of %llu records; csim -C needs the text trace\n",
+                threaded);
+    return ferror(out);
+}
+
+
+
+int unpack(FILE* in, FILE* out)
+
+{
+
+    size_dict dict = {};
+    unsigned long long prev = 0;
+    char magic[TRACE_MAGIC_LEN];
+    int h;
+
+    if (fread(magic, 1, TRACE_MAGIC_LEN, in) != TRACE_MAGIC_LEN
+        || memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN))
+        return 1;
+
+    while ((h = getc(in)) != EOF)
+
+    {
+        int code = h & 0x3f;
+        unsigned long long size;
+        unsigned long long delta;
+
+        if (code == TRACE_SIZE_NEW)
+        {
+            if (!get_varint(in, &size))
+                return 1;
+            if (dict.count < TRACE_SIZE_NEW)
+                dict.sizes[dict.count++] = (int)size;
+        }
+        else if (code < dict.count)
+            size = dict.sizes[code];
+        else
+            return 1;
+
+        if (!get_varint(in, &delta))
+            return 1;
+        prev += (delta >> 1) ^ -(delta & 1);
+
+        // same layout as valgrind: instruction loads are not indented
+        fprintf(out, "%s%c %llx,%d\n", h >> 6 == TRACE_OP_I ? "" : " ",
+                op_chars[h >> 6], prev, (int)size);
+    }
+
+    return ferror(out);
+}
+
+
+
+int main(int argc, char* argv[])
+
+{
+
+    int opt;
+    int decode = 0;
+
+    while ((opt = getopt(argc, argv, "dh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd':
+            decode = 1;
+            break;
+        case 'h':
+            printf("Usage: ./csim-pack [-d] <input> <output>\n");
+            return 0;
+        default:
+            return 1;
+        }
+    }
+
+    if (argc - optind != 2)
+        return 1;
+
+    FILE* in = strcmp(argv[optind], "-") ? fopen(argv[optind], "rb") : stdin;
+    FILE* out = strcmp(argv[optind + 1], "-") ? fopen(argv[optind + 1], "wb") : stdout;
+
+    if (!in || !out)
+        return 1;
+
+    int failed = decode ? unpack(in, out) : pack(in, out);
+
+    fclose(in);
+    if (fclose(out))
+        failed = 1;
+    return failed;
+}
@@ -0,0 +1,622 @@
+/* 20210741 김소현 */
+/* sooohyun@postech.ac.kr*/
+
+/*
+ * csim-test - regression tests for csim against hand-checked counts
+ *
+ *   gcc -g -Wall -Werror -std=c99 -m64 -O2 -o csim-test csim-test.c
+ *   ./csim-test [-c <csim>] [-p <csim-pack>] [-v] [<test> ...]
+ *
+ * Each test writes a small trace, runs csim on it with the test's
+ * options and compares everything csim prints on stdout with the
+ * expected lines, which were worked out by hand (see the comment on each
+ * test). A test without expected lines instead compares the output with
+ * a second run on the same trace with other options, which must not
+ * change the result; these use a generated pseudo-random trace. A pack
+ * test converts its trace with csim-pack, checks that csim-pack -d gives
+ * the text back byte for byte, and compares csim on the binary trace with
+ * csim on the text. A log test also passes -e and appends the event log
+ * to the output as "event <record> set <set> result <result>" lines. With
+ * no test names every test runs except the slow ones, which run only when
+ * named:
+ *
+ *   ./csim-test scale      -g past 2^32 accesses, a minute or two at -O2
+ *
+ * -v prints csim's output for failures. Exits 1 if any test fails.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "csim.h"
+
+#define MAX_ARGS 16
+
+
+
+typedef struct
+{
+    const char* name;
+    const char* args[MAX_ARGS];    // csim options, -t <trace> is added
+    const char* trace;             // 0: no trace file (-g), unless `records`
+    int records;                   // generate a trace of this many records
+    const char* expected;          // 0: compare with the run with `against`
+    const char* against[MAX_ARGS];
+    int pack;                      // run on the csim-pack binary, against the text
+    int log;                       // append the -e event log to the output
+    int slow;                      // only run when named
+} test;
+
+
+
+static const test tests[] = {
+
+    // L1 2-way, L2 2-way inclusive, one set each, 16-byte blocks.
+    //   S 0   both miss; L1 holds 0 dirty
+    //   L 10  both miss
+    //   L 0   L1 hit; L2 keeps 0 as its LRU line
+    //   L 20  L1 evicts 10 (clean). L2 evicts 0, whose back-invalidation
+    //         drops the dirty L1 copy: L1 writes it back, so L2's victim
+    //         leaves dirty and L2 writes back too
+    // AMAT (1 + 1 per level, 100 for memory): (3 * 102 + 1) / 4
+    { .name = "inclusive",
+      .args = { "-L", "0,2,4", "-L", "0,2,4,inclusive" },
+      .trace = " S 0,4\n L 10,4\n L 0,4\n L 20,4\n",
+      .expected = "L1 (s=0 E=2 b=4 nine) hits:1 misses:3 evictions:1 back-invalidations:0"
+      " dirty-evictions:1 bytes-read:48 bytes-written:16\n"
+      "L2 (s=0 E=2 b=4 inclusive) hits:0 misses:3 evictions:1 back-invalidations:1"
+      " dirty-evictions:1 bytes-read:48 bytes-written:16\n"
+      "AMAT: 76.75 cycles\n" },
+
+    // L1 direct-mapped, L2 direct-mapped exclusive, 16-byte blocks.
+    //   S 0   L1 fills 0 dirty, L2 misses
+    //   L 10  L1 evicts 0 dirty: written back into L2 (no fetch)
+    //   L 0   L1 evicts 10, L2 hits 0 and hands it up still dirty; 10
+    //         spills into L2
+    //   L 20  L1 evicts 0 dirty into L2, which evicts 10 (clean, dropped)
+    //   L 30  L1 evicts 20 into L2, which evicts 0 and writes it back
+    // L2 never reads from memory. AMAT: (4 * 102 + 2) / 5
+    { .name = "exclusive",
+      .args = { "-L", "0,1,4", "-L", "0,1,4,exclusive" },
+      .trace = " S 0,4\n L 10,4\n L 0,4\n L 20,4\n L 30,4\n",
+      .expected = "L1 (s=0 E=1 b=4 nine) hits:0 misses:5 evictions:4 back-invalidations:0"
+      " dirty-evictions:2 bytes-read:80 bytes-written:32\n"
+      "L2 (s=0 E=1 b=4 exclusive) hits:1 misses:4 evictions:2 back-invalidations:0"
+      " dirty-evictions:1 bytes-read:0 bytes-written:16\n"
+      "AMAT: 82.00 cycles\n" },
+
+    // L1 direct-mapped, L2 direct-mapped NINE, 16-byte blocks.
+    //   S 0   both miss; L1 holds 0 dirty
+    //   L 10  L1 evicts 0 dirty; the write-back reaches L2 first and
+    //         dirties its copy, then L2 misses on 10 and writes 0 back
+    //   L 10  L1 hit
+    //   L 20  L1 evicts 10 (clean, dropped), L2 evicts 10
+    // AMAT: (3 * 102 + 1) / 4
+    { .name = "nine",
+      .args = { "-L", "0,1,4", "-L", "0,1,4,nine" },
+      .trace = " S 0,4\n L 10,4\n L 10,4\n L 20,4\n",
+      .expected = "L1 (s=0 E=1 b=4 nine) hits:1 misses:3 evictions:2 back-invalidations:0"
+      " dirty-evictions:1 bytes-read:48 bytes-written:16\n"
+      "L2 (s=0 E=1 b=4 nine) hits:0 misses:3 evictions:2 back-invalidations:0"
+      " dirty-evictions:1 bytes-read:48 bytes-written:16\n"
+      "AMAT: 76.75 cycles\n" },
+
+    // L1 2-way, L2 2-way inclusive, one set each: L1's dirty victim is
+    // also L2's victim on the same access.
+    //   S 0   both miss; L1 holds 0 dirty
+    //   L 10  both miss; 0 is the LRU line of both
+    //   L 20  L1 evicts 0 dirty, which dirties L2's copy; L2 then misses
+    //         on 20 and evicts 0, one write-back. L2 keeps 10 and 20, so
+    //         nothing in L1 is back-invalidated
+    //   L 10  L1 hit
+    // AMAT: (3 * 102 + 1) / 4
+    { .name = "inclusive2",
+      .args = { "-L", "0,2,4", "-L", "0,2,4,inclusive" },
+      .trace = " S 0,4\n L 10,4\n L 20,4\n L 10,4\n",
+      .expected = "L1 (s=0 E=2 b=4 nine) hits:1 misses:3 evictions:1 back-invalidations:0"
+      " dirty-evictions:1 bytes-read:48 bytes-written:16\n"
+      "L2 (s=0 E=2 b=4 inclusive) hits:0 misses:3 evictions:1 back-invalidations:0"
+      " dirty-evictions:1 bytes-read:48 bytes-written:16\n"
+      "AMAT: 76.75 cycles\n" },
+
+    // Replacement policies, all in set 0 of s=1 b=4 (blocks 0x20 apart);
+    // each trace is one where the policy parts from LRU.
+    // fifo, E=2: A B A C A
+    //   A, B miss; A hits without moving; C evicts A, the first filled
+    //   (LRU would evict B); A misses and evicts B
+    { .name = "fifo",
+      .args = { "-s", "1", "-E", "2", "-b", "4", "-p", "fifo" },
+      .trace = " L 0,4\n L 20,4\n L 0,4\n L 40,4\n L 0,4\n",
+      .expected = "hits:1 misses:4 evictions:2\n" },
+
+    // plru, E=4: A B C D A E B
+    //   A-D fill ways 0-3, each fill points the tree away from its way:
+    //   root at the left half, both leaves at their left way. A hit in way
+    //   0 points the root right, so E evicts C in way 2, not B (the LRU
+    //   line); B hits
+    { .name = "plru",
+      .args = { "-s", "1", "-E", "4", "-b", "4", "-p", "plru" },
+      .trace = " L 0,4\n L 20,4\n L 40,4\n L 60,4\n L 0,4\n L 80,4\n L 20,4\n",
+      .expected = "hits:2 misses:5 evictions:1\n" },
+
+    // nru, E=2: A B A C A B
+    //   A, B miss and set their bits; A hits. C finds no clear bit, clears
+    //   both and evicts way 0, A. A misses and evicts B (clear bit), B
+    //   misses, finds both set again and evicts C in way 0
+    { .name = "nru",
+      .args = { "-s", "1", "-E", "2", "-b", "4", "-p", "nru" },
+      .trace = " L 0,4\n L 20,4\n L 0,4\n L 40,4\n L 0,4\n L 20,4\n",
+      .expected = "hits:1 misses:5 evictions:3\n" },
+
+    // srrip, E=2: A A B C D A
+    //   A fills at RRPV 2, hits to 0; B fills at 2. C: the largest is B's
+    //   2, everyone ages by 1 (A 1, B 3), B goes and C fills at 2. D:
+    //   ages again (A 2, C 3) and evicts C, so A survives the scan and hits
+    { .name = "srrip",
+      .args = { "-s", "1", "-E", "2", "-b", "4", "-p", "srrip" },
+      .trace = " L 0,4\n L 0,4\n L 20,4\n L 40,4\n L 60,4\n L 0,4\n",
+      .expected = "hits:2 misses:4 evictions:2\n" },
+
+    // brrip, E=2: A A B B C A B
+    //   fills go in at RRPV 3 (only every 32nd at 2); A and B hit to 0.
+    //   C: a tie at 0 picks way 0, everyone ages to 3, A goes and C fills
+    //   at 3. A evicts C, the first way at 3, and B hits (SRRIP, filling
+    //   C at 2, would evict B instead)
+    { .name = "brrip",
+      .args = { "-s", "1", "-E", "2", "-b", "4", "-p", "brrip" },
+      .trace = " L 0,4\n L 0,4\n L 20,4\n L 20,4\n L 40,4\n L 0,4\n L 20,4\n",
+      .expected = "hits:3 misses:4 evictions:2\n" },
+
+    // opt, E=2: A B C A B
+    //   C evicts B, used later than A; A hits; B misses and evicts C or A,
+    //   neither used again
+    { .name = "opt",
+      .args = { "-s", "1", "-E", "2", "-b", "4", "-p", "opt" },
+      .trace = " L 0,4\n L 20,4\n L 40,4\n L 0,4\n L 20,4\n",
+      .expected = "hits:1 misses:4 evictions:2\n" },
+
+    // -c, s=1 E=1 b=4 (two blocks) against a 2-block fully associative
+    // LRU shadow. A and B share set 0, C is in set 1.
+    //   A, B  compulsory; B evicts A
+    //   A     the shadow still holds A: conflict, evicts B
+    //   C     compulsory; the shadow drops B, its LRU line
+    //   B     gone from the shadow too: capacity, evicts A
+    //   C     hit
+    { .name = "classify",
+      .args = { "-s", "1", "-E", "1", "-b", "4", "-c" },
+      .trace = " L 0,4\n L 20,4\n L 0,4\n L 10,4\n L 20,4\n L 10,4\n",
+      .expected = "hits:1 misses:5 evictions:3\n"
+      "compulsory:3 capacity:1 conflict:1\n"
+      "set 0 compulsory:2 capacity:1 conflict:1\n"
+      "set 1 compulsory:1 capacity:0 conflict:0\n" },
+
+    // -k 1 samples every set, so the estimate is the classify trace's
+    // exact count and the interval is 0 (finite population correction)
+    { .name = "sample-k1",
+      .args = { "-s", "1", "-E", "1", "-b", "4", "-k", "1" },
+      .trace = " L 0,4\n L 20,4\n L 0,4\n L 10,4\n L 20,4\n L 10,4\n",
+      .expected = "hits:1 misses:5 evictions:3\n"
+      "sampled 2 of 2 sets, 95% CI hits:+-0 misses:+-0 evictions:+-0\n" },
+
+    // -K 2,4,1, s=1 E=1 b=4, A and B in set 0: periods of 4 records, 1
+    // warm-up, 2 measured, 1 skipped.
+    //   A [A B] (B)  warm miss; window hit, miss + eviction
+    //   B [B B] (A)  warm hit; window 2 hits
+    // 8 records are 4 windows' worth: hits 4 * 1.5 = 6, misses and
+    // evictions 4 * 0.5 = 2. Each has sample variance 0.5, so the half
+    // width is 1.96 * 4 * sqrt(0.5 / 2 * (1 - 2 / 4)) = 2.77
+    { .name = "sample-K",
+      .args = { "-s", "1", "-E", "1", "-b", "4", "-K", "2,4,1" },
+      .trace = " L 0,4\n L 0,4\n L 20,4\n L 0,4\n L 20,4\n L 20,4\n L 20,4\n L 0,4\n",
+      .expected = "hits:6 misses:2 evictions:2\n"
+      "sampled 2 of 4 windows, 95% CI hits:+-3 misses:+-3 evictions:+-3\n" },
+
+    // -P next, s=1 E=1 b=4: block n is in set n % 2.
+    //   L 0   miss; prefetches block 1
+    //   L 10  prefetch hit, which triggers block 2: evicts block 0
+    //   L 20  prefetch hit, triggers block 3: evicts block 1
+    //   L 0   miss, evicts block 2; block 1 evicts block 3, never used
+    // accuracy 2 / 4 prefetches, coverage 2 / (2 + 2 misses)
+    { .name = "prefetch",
+      .args = { "-s", "1", "-E", "1", "-b", "4", "-P", "next" },
+      .trace = " L 0,4\n L 10,4\n L 20,4\n L 0,4\n",
+      .expected = "hits:2 misses:2 evictions:1\n"
+      "prefetches:4 prefetch-hits:2 useless-prefetches:1 prefetch-evictions:3"
+      " accuracy:0.500 coverage:0.500\n" },
+
+    // -v and -e, s=1 E=1 b=4: A (0) and B (20) share set 0, C (10) is in
+    // set 1. The I record is skipped and takes no record number.
+    //   L A   miss
+    //   M B   the load evicts A, the store hits
+    //   S A   evicts B
+    //   L C   miss in set 1
+    // The log has one event per access (result 0 hit, 1 miss, 2 eviction),
+    // both of the M's under record 1
+    { .name = "events",
+      .args = { "-s", "1", "-E", "1", "-b", "4", "-v" },
+      .trace = " L 0,4\n M 20,4\nI 400,4\n S 0,8\n L 10,1\n",
+      .expected = "L 0, 4 miss \nM 20, 4 eviction hit \nS 0, 8 eviction \nL 10, 1 miss \n"
+      "hits:1 misses:4 evictions:2\n"
+      "event 0 set 0 result 1\nevent 1 set 0 result 2\nevent 1 set 0 result 0\n"
+      "event 2 set 0 result 2\nevent 3 set 1 result 1\n",
+      .log = 1 },
+
+    // -j shards the sets over threads; the merged counts must not change
+    { .name = "threads-s2",
+      .args = { "-s", "2", "-E", "1", "-b", "4", "-j", "4" },
+      .against = { "-s", "2", "-E", "1", "-b", "4", "-j", "1" },
+      .records = 20000 },
+    { .name = "threads-s3",
+      .args = { "-s", "3", "-E", "2", "-b", "4", "-j", "4" },
+      .against = { "-s", "3", "-E", "2", "-b", "4", "-j", "1" },
+      .records = 20000 },
+    { .name = "threads-s4",
+      .args = { "-s", "4", "-E", "2", "-b", "4", "-j", "4" },
+      .against = { "-s", "4", "-E", "2", "-b", "4", "-j", "1" },
+      .records = 20000 },
+
+    // -R runs repeats of a reference as hits without a lookup; every
+    // policy and write mode must count exactly as the plain loop, traffic
+    // included (-w wb prints it). opt is refused with -R
+    { .name = "R-lru",
+      .args = { "-s", "2", "-E", "4", "-b", "4", "-p", "lru", "-w", "wb", "-R" },
+      .against = { "-s", "2", "-E", "4", "-b", "4", "-p", "lru", "-w", "wb" },
+      .records = 20000 },
+    { .name = "R-fifo",
+      .args = { "-s", "2", "-E", "4", "-b", "4", "-p", "fifo", "-w", "wb", "-R" },
+      .against = { "-s", "2", "-E", "4", "-b", "4", "-p", "fifo", "-w", "wb" },
+      .records = 20000 },
+    { .name = "R-random",
+      .args = { "-s", "2", "-E", "4", "-b", "4", "-p", "random", "-w", "wb", "-R" },
+      .against = { "-s", "2", "-E", "4", "-b", "4", "-p", "random", "-w", "wb" },
+      .records = 20000 },
+    { .name = "R-plru",
+      .args = { "-s", "2", "-E", "4", "-b", "4", "-p", "plru", "-w", "wb", "-R" },
+      .against = { "-s", "2", "-E", "4", "-b", "4", "-p", "plru", "-w", "wb" },
+      .records = 20000 },
+    { .name = "R-nru",
+      .args = { "-s", "2", "-E", "4", "-b", "4", "-p", "nru", "-w", "wb", "-R" },
+      .against = { "-s", "2", "-E", "4", "-b", "4", "-p", "nru", "-w", "wb" },
+      .records = 20000 },
+    { .name = "R-srrip",
+      .args = { "-s", "2", "-E", "4", "-b", "4", "-p", "srrip", "-w", "wb", "-R" },
+      .against = { "-s", "2", "-E", "4", "-b", "4", "-p", "srrip", "-w", "wb" },
+      .records = 20000 },
+    { .name = "R-brrip",
+      .args = { "-s", "2", "-E", "4", "-b", "4", "-p", "brrip", "-w", "wb", "-R" },
+      .against = { "-s", "2", "-E", "4", "-b", "4", "-p", "brrip", "-w", "wb" },
+      .records = 20000 },
+    { .name = "R-wt",
+      .args = { "-s", "2", "-E", "4", "-b", "4", "-w", "wt", "-R" },
+      .against = { "-s", "2", "-E", "4", "-b", "4", "-w", "wt" },
+      .records = 20000 },
+    { .name = "R-nwa",
+      .args = { "-s", "2", "-E", "4", "-b", "4", "-a", "nwa", "-R" },
+      .against = { "-s", "2", "-E", "4", "-b", "4", "-a", "nwa" },
+      .records = 20000 },
+    { .name = "R-wt-nwa",
+      .args = { "-s", "2", "-E", "4", "-b", "4", "-w", "wt", "-a", "nwa", "-R" },
+      .against = { "-s", "2", "-E", "4", "-b", "4", "-w", "wt", "-a", "nwa" },
+      .records = 20000 },
+
+    // csim-pack round trips, in csim-pack -d's layout (I not indented):
+    // every op, sizes past one byte of varint, deltas both ways and an
+    // address with the top bit set
+    { .name = "pack",
+      .args = { "-s", "2", "-E", "2", "-b", "4", "-w", "wb" },
+      .trace = "I 400d7d4,8\n L 7ff000388,4\n S 7ff000390,8\n M 601040,4\n L 601040,1\n"
+      "I 400d7dc,3\n S ffff800000000000,200\n L 0,4\n M 7ff000388,8\n L 601044,2\n",
+      .pack = 1 },
+    { .name = "pack-gen",
+      .args = { "-s", "2", "-E", "2", "-b", "4", "-w", "wb" },
+      .records = 20000,
+      .pack = 1 },
+
+    // -g scaling: 5000000001 sequential 8-byte loads, 8 per 64-byte
+    // block, so ceil(n / 8) = 625000001 misses, the other 4375000000
+    // accesses hit (past 2^32 as well), and every miss after the first 32
+    // (16 sets x 2 ways) evicts
+    { .name = "scale",
+      .args = { "-s", "4", "-E", "2", "-b", "6", "-g", "5000000001" },
+      .expected = "hits:4375000000 misses:625000001 evictions:624999969\n",
+      .slow = 1 },
+};
+
+#define TEST_COUNT (int)(sizeof(tests) / sizeof(tests[0]))
+
+
+
+// `records` L/S/M records from a fixed LCG over 2KB, a quarter of them
+// repeating the previous address
+static int write_records(FILE* trace, int records)
+
+{
+
+    unsigned long long r = 1;
+    unsigned long long address = 0x1000;
+
+    for (int i = 0; i < records; i++)
+    {
+        r = r * 6364136223846793005ULL + 1442695040888963407ULL;
+        if ((r >> 40) & 3)
+            address = 0x1000 + (r >> 48) % 512 * 4;
+        if (fprintf(trace, " %c %llx,4\n", "LSM"[(r >> 33) % 3], address) < 0)
+            return 1;
+    }
+    return 0;
+}
+
+
+
+// run argv[0]; its stdout goes to `out`, its stderr nowhere if `quiet`
+static int run(const char* const* argv, char* out, size_t size, int quiet)
+
+{
+
+    int fds[2];
+    size_t length = 0;
+    ssize_t n;
+    int status;
+
+    if (pipe(fds))
+        return 1;
+
+    pid_t pid = fork();
+
+    if (pid < 0)
+        return 1;
+
+    if (!pid)
+    {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        if (quiet && freopen("/dev/null", "w", stderr) == NULL)
+            _exit(127);
+        execv(argv[0], (char* const*)argv);
+        _exit(127);
+    }
+
+    close(fds[1]);
+    while ((n = read(fds[0], out + length, size - 1 - length)) > 0)
+        length += n;
+    close(fds[0]);
+    out[length] = 0;
+
+    return waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status);
+}
+
+
+
+// run csim with `args` on `path`, and -e `log` unless 0; its stdout goes
+// to `out`
+static int run_csim(const char* csim, const char* const* args, const char* path,
+                    const char* log, char* out, size_t size)
+
+{
+
+    const char* argv[MAX_ARGS + 6] = { csim };
+    int argc = 1;
+
+    for (int i = 0; i < MAX_ARGS && args[i]; i++)
+        argv[argc++] = args[i];
+    if (path)
+    {
+        argv[argc++] = "-t";
+        argv[argc++] = path;
+    }
+    if (log)
+    {
+        argv[argc++] = "-e";
+        argv[argc++] = log;
+    }
+    return run(argv, out, size, 0);
+}
+
+
+
+// append the events in `log` to `out` as text; returns 1 on a bad log
+static int append_events(const char* log, char* out, size_t size)
+
+{
+
+    FILE* in = fopen(log, "rb");
+    char magic[EVENT_MAGIC_LEN];
+    csim_event e;
+    size_t length = strlen(out);
+    int failed;
+
+    if (!in)
+        return 1;
+    failed = fread(magic, 1, EVENT_MAGIC_LEN, in) != EVENT_MAGIC_LEN
+          || memcmp(magic, EVENT_MAGIC, EVENT_MAGIC_LEN);
+    while (!failed && fread(&e, sizeof(e), 1, in) == 1)
+    {
+        int n = snprintf(out + length, size - length, "event %llu set %u result %u\n", e.index,
+                         e.set, e.result);
+        failed = n < 0 || (size_t)n >= size - length;
+        length += failed ? 0 : n;
+    }
+    fclose(in);
+    return failed;
+}
+
+
+
+// 0 if the two files have the same bytes
+static int compare_files(const char* a, const char* b)
+
+{
+
+    FILE* x = fopen(a, "rb");
+    FILE* y = fopen(b, "rb");
+    int differ = !x || !y;
+
+    while (!differ)
+    {
+        int c = getc(x);
+        differ = c != getc(y);
+        if (c == EOF)
+            break;
+    }
+    if (x)
+        fclose(x);
+    if (y)
+        fclose(y);
+    return differ;
+}
+
+
+
+// pack `path` into `binary`, then check that unpacking gives `path` back
+static int round_trip(const char* pack, const char* path, const char* binary)
+
+{
+
+    char text[] = "/tmp/csim-test-XXXXXX";
+    char out[64];
+    int fd = mkstemp(text);
+    int failed;
+
+    if (fd < 0)
+        return 1;
+    close(fd);
+
+    const char* to_binary[] = { pack, path, binary, 0 };
+    const char* to_text[] = { pack, "-d", binary, text, 0 };
+    failed = run(to_binary, out, sizeof(out), 1) || run(to_text, out, sizeof(out), 1)
+          || compare_files(path, text);
+    unlink(text);
+    return failed;
+}
+
+
+
+static int run_test(const char* csim, const char* pack, const test* t, int verbose)
+
+{
+
+    char path[] = "/tmp/csim-test-XXXXXX";
+    char binary[] = "/tmp/csim-test-XXXXXX";
+    char log[] = "/tmp/csim-test-XXXXXX";
+    char out[4096];
+    char want[4096] = "";
+    const char* expected = t->expected ? t->expected : want;
+    int has_trace = t->trace || t->records;
+    int failed;
+
+    if (has_trace)
+    {
+        int fd = mkstemp(path);
+        FILE* trace = fd < 0 ? 0 : fdopen(fd, "w");
+
+        if (!trace)
+            return 1;
+        failed = t->trace ? fputs(t->trace, trace) < 0 : write_records(trace, t->records);
+        if (fclose(trace) || failed)
+        {
+            unlink(path);
+            return 1;
+        }
+    }
+
+    if (t->pack)
+    {
+        int fd = mkstemp(binary);
+        if (fd < 0)
+        {
+            unlink(path);
+            return 1;
+        }
+        close(fd);
+        failed = round_trip(pack, path, binary)
+              || run_csim(csim, t->args, binary, 0, out, sizeof(out));
+        unlink(binary);
+    }
+    else if (t->log)
+    {
+        int fd = mkstemp(log);
+        if (fd < 0)
+        {
+            unlink(path);
+            return 1;
+        }
+        close(fd);
+        failed = run_csim(csim, t->args, has_trace ? path : 0, log, out, sizeof(out))
+              || append_events(log, out, sizeof(out));
+        unlink(log);
+    }
+    else
+        failed = run_csim(csim, t->args, has_trace ? path : 0, 0, out, sizeof(out));
+    if (!t->expected)
+    {
+        const char* const* args = t->pack ? t->args : t->against;
+        failed |= run_csim(csim, args, has_trace ? path : 0, 0, want, sizeof(want)) || !*want;
+    }
+    failed = failed || strcmp(out, expected);
+    if (has_trace)
+        unlink(path);
+
+    printf("%-12s %s\n", t->name, failed ? "FAIL" : "ok");
+    if (failed && verbose)
+        printf("expected:\n%sgot:\n%s", expected, out);
+    return failed;
+}
+
+
+
+int main(int argc, char* argv[])
+
+{
+
+    const char* csim = "./csim";
+    const char* pack = "./csim-pack";
+    int verbose = 0;
+    int failures = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:p:vh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            csim = optarg;
+            break;
+        case 'p':
+            pack = optarg;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'h':
+            printf("Usage: ./csim-test [-c <csim>] [-p <csim-pack>] [-v] [<test> ...]\n");
+            return 0;
+        default:
+            return 1;
+        }
+    }
+
+    for (int i = optind; i < argc; i++)
+    {
+        int k = 0;
+        while (k < TEST_COUNT && strcmp(tests[k].name, argv[i]))
+            k++;
+        if (k == TEST_COUNT)
+            return 1;
+    }
+
+    for (int k = 0; k < TEST_COUNT; k++)
+    {
+        int selected = optind == argc && !tests[k].slow;
+        for (int i = optind; i < argc; i++)
+            selected |= !strcmp(tests[k].name, argv[i]);
+        if (selected)
+            failures += run_test(csim, pack, &tests[k], verbose);
+    }
+
+    printf("%d failed\n", failures);
+    return failures != 0;
+}
@@ -2,27 +2,82 @@
 /* sooohyun@postech.ac.kr*/
 
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include "cachelab.h"
+#include "csim.h"
 #include <getopt.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <math.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+
+
+#define TAG_CHUNK 8 // ways compared per SIMD step, sets are padded to this
+
+
+
+// structure-of-arrays set: way i is tags[i] / last_use[i], valid bit i
+typedef struct
+{
+    unsigned long long* tags;
+    unsigned long long* last_use; // value of Cache.clock at last access
+    unsigned long long* valid;    // bitmask, one word per 64 ways
+    unsigned long long* dirty;    // bitmask, same layout as valid
+    unsigned long long* prefetched; // bitmask, prefetched and not used yet (-P only)
+    unsigned long long state;     // per-set replacement state, see policy_touch
+} set;
+
+
+
+enum { PREFETCH_NEXT = 1, PREFETCH_STRIDE, PREFETCH_STREAM };
+
+#define PF_TABLE 16       // stride regions / streams tracked
+#define PF_REGION_BITS 12 // stride prefetcher trains per 4KB region
+#define PF_CONFIDENT 2    // matching steps seen before a stride or stream prefetches
 
 
 
 typedef struct
 {
-    int valid;
-    unsigned tag;
-    int count_LRU;
-} line;
+    unsigned long long key;  // region (stride) or next expected block (stream)
+    unsigned long long last; // last block seen in the region
+    long long stride;        // in blocks; a stream's direction
+    int confidence;
+    unsigned long long used; // prefetcher.clock at last use, 0 = free
+} pf_entry;
 
 
 
+// -P state
 typedef struct
 {
-    line* lines;
-} set;
+    int kind;     // PREFETCH_*
+    int degree;   // blocks fetched per trigger
+    int distance; // how far ahead the first one is
+    int tagged;   // the current access hit a prefetched block
+    pf_entry table[PF_TABLE];
+    unsigned long long clock;
+    unsigned long long issued;    // blocks actually fetched
+    unsigned long long hits;      // demand hits on a prefetched block, counted once
+    unsigned long long useless;   // prefetched blocks evicted before any use
+    unsigned long long evictions; // valid blocks a prefetch pushed out
+} prefetcher;
 
 
 
@@ -33,15 +88,354 @@ typedef struct
     int s; //set num
     int E; // line num
     int b;
+    unsigned long long clock; // global access counter for LRU stamps
+    unsigned long long victim_address; // block evicted by the last update()
+    int victim_dirty;                  // and whether it was written back
+    int policy;               // POLICY_*
+    unsigned long long* opt_next; // OPT: next reference time of every access
+
+    int write_through;        // -w wt, otherwise write-back
+    int no_write_allocate;    // -a nwa, otherwise write-allocate
+    unsigned long long dirty_evictions;
+    unsigned long long bytes_read;    // fetched from the next level
+    unsigned long long bytes_written; // sent to the next level
+
+    int ways;          // E rounded up to TAG_CHUNK
+    int valid_words;   // words of valid bits per set
+    unsigned long long* tag_store;
+    unsigned long long* use_store;
+    unsigned long long* valid_store;
+    unsigned long long* dirty_store;
+    unsigned long long* prefetched_store;
+    prefetcher* prefetch;     // -P, 0 = none; set before init_cache
+    struct tlb* tlb;          // -T, 0 = none
+    unsigned char* sampled;   // -k: 1 for each simulated set, 0 = every set
 
 } Cache;
 
 
-int check_hit(set* cache_set, int n, int tag, int* hit);
-int check_miss(set* cache_set, int n, int tag, int* miss);
-int check_eviction(set* cache_set, int E, int tag, int* eviction);
-void update(Cache* cache, int verbose, int address, int* hit, int* miss, int* eviction);
 
+// replacement policies, see policy_touch
+#define POLICIES(X)                 \
+    X(lru, POLICY_LRU)              \
+    X(fifo, POLICY_FIFO)            \
+    X(random, POLICY_RANDOM)        \
+    X(plru, POLICY_PLRU)            \
+    X(nru, POLICY_NRU)              \
+    X(srrip, POLICY_SRRIP)          \
+    X(brrip, POLICY_BRRIP)          \
+    X(opt, POLICY_OPT)
+
+#define POLICY_ENUM(name, id) id,
+#define POLICY_NAME(name, id) #name,
+
+enum { POLICIES(POLICY_ENUM) POLICY_COUNT };
+
+static const char* policy_names[] = { POLICIES(POLICY_NAME) };
+
+
+
+typedef struct
+{
+    unsigned long long block;
+    unsigned long long value;
+    int used;
+} block_entry;
+
+
+
+typedef struct
+{
+    block_entry* entries;
+    size_t size; // power of two
+    size_t used;
+} block_map;
+
+
+
+// -c state: shadow fully associative LRU cache and miss classes
+typedef struct
+{
+    block_map seen;             // every block touched; value = shadow node + 1, 0 if not resident
+    long* prev;                 // recency list over shadow nodes, MRU first
+    long* next;
+    unsigned long long* block;  // block held by each node
+    long head;
+    long tail;
+    size_t count;
+    size_t capacity;            // S * E blocks, same as the real cache
+    unsigned long long compulsory;
+    unsigned long long capacity_misses;
+    unsigned long long conflict;
+    unsigned long long* per_set; // compulsory, capacity, conflict for each set
+} three_c;
+
+
+
+// -T: DTLB, optional STLB and page-walk caches, see tlb_access
+typedef struct tlb
+{
+    Cache l1;       // b = page shift
+    Cache l2;       // E = 0 without an STLB
+    Cache walk[3];  // PML4E, PDPTE, PDE caches
+    int page_shift; // 12, 21 or 30; 0 = no -T
+    int levels;     // page-table levels walked: 4, 3 or 2
+    unsigned long long l1_hit;
+    unsigned long long l1_miss;
+    unsigned long long l2_hit;
+    unsigned long long l2_miss;
+    unsigned long long walks;
+    unsigned long long walk_references; // page-table entries read from memory
+    unsigned long long walk_hit[3];
+    unsigned long long walk_miss[3];
+} tlb;
+
+
+
+// -k / -K state. A unit is a sampled set, or a measured window under -K;
+// hit/miss/eviction are summed (and squared) over units for the estimate
+typedef struct
+{
+    int set_ratio;                // -k: simulate about 1 set in set_ratio
+    unsigned long long window;    // -K: records counted per period, 0 = no time sampling
+    unsigned long long period;
+    unsigned long long warmup;    // records simulated but not counted before each window
+    unsigned long long sets;      // sets simulated
+    unsigned long long* per_set;  // hit, miss, eviction for each set (set sampling only)
+    unsigned long long units;
+    double population;            // units in the whole cache / trace
+    double sum[3];
+    double square[3];
+} sampler;
+
+
+
+// trace file mapped into memory, records are parsed in place
+typedef struct
+{
+    char* data;
+    char* cur;
+    char* end;
+    size_t length;
+    int mapped; // 0 if data was read into a heap buffer (pipes etc.)
+
+    int binary; // csim-pack format, see csim.h
+    unsigned long long prev_address;
+    int sizes[TRACE_SIZE_NEW];
+    int size_count;
+    int thread; // -C: thread id of the last record ("L addr,size,tid"), 0 if none
+} trace;
+
+
+
+// -R: a run of consecutive accesses to one block
+typedef struct
+{
+    unsigned long long address;     // first access
+    int store;                      // its store size, 0 for a load
+    unsigned long long repeats;     // further accesses to the same block
+    unsigned long long stores;      // how many of the repeats are stores
+    unsigned long long store_bytes;
+    unsigned long long records;     // trace records covered, an M counts once
+} reference;
+
+
+
+// -R pre-pass state: one record of look-ahead
+typedef struct
+{
+    trace* file;
+    int b;
+    int no_write_allocate;
+    int pending; // op / address / size hold a record not yet consumed
+    char op;
+    unsigned long long address;
+    int size;
+} coalescer;
+
+
+
+// update() outcome; on RESULT_EVICTION the evicted block is Cache.victim_address,
+// RESULT_SKIPPED means the set is not sampled (-k) and nothing was counted.
+// The first three are also the csim_event.result values, see csim.h
+enum { RESULT_HIT, RESULT_MISS, RESULT_EVICTION, RESULT_SKIPPED };
+
+enum { VERBOSE_TEXT = 1, VERBOSE_LOG = 2 }; // bits of the verbose argument: -v, -e
+
+
+
+#define MAX_LEVELS 4
+
+enum { INCLUSIVE, EXCLUSIVE, NINE }; // relation of a level to the levels above it
+
+// one level of an -L cache hierarchy, L1 first
+typedef struct
+{
+    Cache cache;
+    int policy;
+    int latency;
+    unsigned long long hit;
+    unsigned long long miss;
+    unsigned long long eviction;
+    unsigned long long back_invalidations; // upper-level copies dropped to keep inclusion
+} level;
+
+// blocks evicted from one level on their way into the next; each block
+// coming in can push out at most one more, so level i sends at most i + 1
+typedef struct
+{
+    unsigned long long address[MAX_LEVELS];
+    int dirty[MAX_LEVELS];
+    int n;
+} victim_list;
+
+
+
+#define MAX_CORES 16
+
+// -C: one shared line's coherence history
+typedef struct
+{
+    unsigned long long block;
+    unsigned long long invalidations;
+    unsigned long long coherence_misses;
+    unsigned long long false_sharing;
+    unsigned lost;                         // cores whose copy was invalidated, one bit each
+    unsigned long long written[MAX_CORES]; // bytes others wrote since that core lost it
+} line_record;
+
+
+
+// -C: one private cache. The shared bit sits beside valid and dirty, so
+// a way is M (dirty), O (dirty, shared), E (clean) or S (clean, shared)
+typedef struct
+{
+    Cache cache;
+    unsigned long long* shared; // bitmask, same layout as the valid bits
+    unsigned long long hit;
+    unsigned long long miss;
+    unsigned long long eviction;
+    unsigned long long invalidations; // copies lost to another core's write
+    unsigned long long coherence_misses;
+    unsigned long long false_sharing;
+    unsigned long long flushes;       // dirty copies handed to another core
+} core;
+
+
+
+typedef struct
+{
+    int n;
+    int moesi;
+    core cores[MAX_CORES];
+    block_map lines; // block -> index into records
+    line_record* records;
+    size_t record_count;
+    size_t record_cap;
+    unsigned long long bus_reads;
+    unsigned long long bus_read_exclusive;
+    unsigned long long bus_upgrades;
+} coherence;
+
+
+
+// one queued reference for a shard: address, how many update() calls and
+// the store size of the last one (0 for a load)
+typedef struct
+{
+    unsigned long long address;
+    int count;
+    int store;
+} job;
+
+
+
+#define RING_SIZE (1 << 14)
+#define RING_BATCH 256
+
+// single-producer single-consumer ring, head/tail on separate cache lines
+typedef struct
+{
+    job slots[RING_SIZE];
+    unsigned head __attribute__((aligned(64))); // next slot to consume
+    unsigned tail __attribute__((aligned(64))); // next slot to publish
+    int done;
+} ring;
+
+
+
+// a worker thread owning every set with set_index % threads == id
+typedef struct
+{
+    Cache cache; // shares sets with the main cache, own clock
+    ring* queue;
+    unsigned long long hit;
+    unsigned long long miss;
+    unsigned long long eviction;
+    pthread_t thread;
+} shard;
+
+
+int init_cache(Cache* cache);
+void free_cache(Cache* cache);
+int update(Cache* cache, int verbose, unsigned long long address, int store,
+           unsigned long long* hit, unsigned long long* miss, unsigned long long* eviction);
+void simulate(Cache* cache, trace* file, int verbose, unsigned long long* hit,
+              unsigned long long* miss, unsigned long long* eviction, unsigned long long* accesses);
+int parse_policy(const char* name);
+int prepare_opt(Cache* cache, trace* file);
+int init_three_c(three_c* c, Cache* cache);
+void free_three_c(three_c* c);
+void simulate_three_c(three_c* c, Cache* cache, trace* file, int verbose, unsigned long long* hit,
+                      unsigned long long* miss, unsigned long long* eviction,
+                      unsigned long long* accesses);
+void print_three_c(three_c* c, Cache* cache);
+int parse_sampling(const char* spec, sampler* sp);
+int init_sampler(sampler* sp, Cache* cache);
+void simulate_sampled(sampler* sp, Cache* cache, trace* file, unsigned long long* accesses);
+void print_sampled(sampler* sp, Cache* cache);
+int parse_prefetch(const char* spec, prefetcher* pf);
+void print_prefetch(prefetcher* pf, unsigned long long miss);
+int set_index_of(Cache* cache, unsigned long long address);
+int simulate_synthetic(Cache* cache, unsigned long long n, unsigned long long* hit,
+                       unsigned long long* miss, unsigned long long* eviction,
+                       unsigned long long* accesses);
+int simulate_sharded(Cache* cache, trace* file, int threads, unsigned long long* hit,
+                     unsigned long long* miss, unsigned long long* eviction,
+                     unsigned long long* accesses);
+int open_trace(trace* t, const char* path);
+int next_record(trace* t, char* op, unsigned long long* address, int* size);
+void close_trace(trace* t);
+void rewind_trace(trace* t);
+int map_init(block_map* m);
+block_entry* map_find(block_map* m, unsigned long long block);
+block_entry* map_insert(block_map* m, unsigned long long block);
+double now_sec(void);
+double time_parse(trace* file);
+int open_event_log(const char* path);
+void close_event_log(void);
+int flush_events(void);
+void print_summary(unsigned long long hit, unsigned long long miss, unsigned long long eviction);
+static void select_tag_kernel(void);
+int sweep(trace* file, const char* s_list, int E_max, const char* b_list);
+int parse_level(const char* spec, level* lv);
+int simulate_hierarchy(trace* file, level* levels, int n, int memory_latency);
+int parse_tlb(const char* spec, tlb* t);
+int init_tlb(tlb* t);
+void free_tlb(tlb* t);
+void tlb_access(tlb* t, unsigned long long address);
+void print_tlb(tlb* t);
+int parse_coherence(const char* spec, coherence* co);
+int init_coherence(coherence* co, int s, int E, int b);
+void free_coherence(coherence* co);
+int simulate_coherence(trace* file, coherence* co, unsigned long long* accesses);
+int next_reference(coalescer* co, reference* r);
+void simulate_coalesced(Cache* cache, trace* file, unsigned long long* hit,
+                        unsigned long long* miss, unsigned long long* eviction,
+                        unsigned long long* accesses, unsigned long long* references);
+
+
+#ifndef CSIM_LIB // -DCSIM_LIB builds the library API alone, see csim.h
 
 int main(int argc, char* argv[])
 
@@ -49,37 +443,146 @@ int main(int argc, char* argv[])
 
     Cache cache = {};
 
-    int hit = 0;
-    int miss = 0;
-    int eviction = 0;
+    unsigned long long hit = 0;
+    unsigned long long miss = 0;
+    unsigned long long eviction = 0;
 
-    FILE* file = 0;
+    trace file = {};
+    int have_trace = 0;
     int verbose = 0;
+    int report = 0;
+    int threads = 1;
+    int sweep_mode = 0;
+    const char* s_list = 0;
+    const char* b_list = 0;
+    level levels[MAX_LEVELS] = {};
+    int nlevels = 0;
+    int memory_latency = 100;
+    int policy = POLICY_LRU;
+    int write_through = 0;
+    int no_write_allocate = 0;
+    int show_traffic = 0;
+    int classify = 0;
+    three_c classes = {};
+    unsigned long long synthetic = 0;
+    int synthetic_failed = 0;
+    sampler sampling = {};
+    prefetcher prefetch = {};
+    static coherence cores; // large, keep it off the stack
+    int coalesce = 0;
+    unsigned long long references = 0;
+    tlb translation = {};
     int opt;
 
-    while ((opt = getopt(argc, argv, "s:E:b:t:hv")) != -1)
+    while ((opt = getopt(argc, argv, "s:E:b:t:j:L:m:p:w:a:g:k:K:P:C:e:T:hvrScR")) != -1)
     {
 
         switch (opt)
         {
         case 's':
             cache.s = atoi(optarg);
+            s_list = optarg;
             break;
         case 'E':
             cache.E = atoi(optarg);
             break;
         case 'b':
             cache.b = atoi(optarg);
+            b_list = optarg;
             break;
         case 't':
-            if (!(file = fopen(optarg, "r"))) 
+            if (have_trace)
+                close_trace(&file);
+            if (open_trace(&file, optarg))
                 return 1;
+            have_trace = 1;
             break;
         case 'h':
-            printf("Usage: ./csim [-hv] -s <s> -E <E> -b <b> -t <tracefile>");
+            printf("Usage: ./csim [-hvrcR] [-e <event log>] [-j <threads>] [-p <policy>]"
+                   " [-w wb|wt] [-a wa|nwa]"
+                   " [-P next|stride|stream[,<degree>[,<distance>]]]"
+                   " [-T 4k|2m|1g,<s>,<E>[,<stlb s>,<stlb E>]]"
+                   " -s <s> -E <E> -b <b> -t <tracefile>\n"
+                   "       ./csim -S -s <s,s,...> -E <Emax> -b <b,b,...> -t <tracefile>\n"
+                   "       ./csim -L <s>,<E>,<b>[,inclusive|exclusive|nine[,<latency>]] [-L ...]"
+                   " [-m <memory latency>] -t <tracefile>\n"
+                   "       ./csim [-p <policy>] -s <s> -E <E> -b <b> -g <synthetic accesses>\n"
+                   "       ./csim -C <caches>[,mesi|moesi] [-p <policy>] -s <s> -E <E> -b <b>"
+                   " -t <tracefile>\n"
+                   "       ./csim [-p <policy>] [-k <set ratio>] [-K <window>,<period>[,<warmup>]]"
+                   " -s <s> -E <E> -b <b> -t <tracefile>\n"
+                   "policies: lru fifo random plru nru srrip brrip opt\n");
             return 0;
         case 'v':
-            verbose = 1;
+            verbose |= VERBOSE_TEXT;
+            break;
+        case 'e':
+            close_event_log();
+            if (open_event_log(optarg))
+                return 1;
+            verbose |= VERBOSE_LOG;
+            break;
+        case 'r':
+            report = 1;
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'S':
+            sweep_mode = 1;
+            break;
+        case 'c':
+            classify = 1;
+            break;
+        case 'R':
+            coalesce = 1;
+            break;
+        case 'T':
+            if (parse_tlb(optarg, &translation))
+                return 1;
+            break;
+        case 'g':
+            synthetic = strtoull(optarg, 0, 10);
+            break;
+        case 'k':
+            if ((sampling.set_ratio = atoi(optarg)) < 1)
+                return 1;
+            break;
+        case 'K':
+            if (parse_sampling(optarg, &sampling))
+                return 1;
+            break;
+        case 'P':
+            if (parse_prefetch(optarg, &prefetch))
+                return 1;
+            break;
+        case 'C':
+            if (parse_coherence(optarg, &cores))
+                return 1;
+            break;
+        case 'L':
+            if (nlevels == MAX_LEVELS || parse_level(optarg, &levels[nlevels]))
+                return 1;
+            nlevels++;
+            break;
+        case 'm':
+            memory_latency = atoi(optarg);
+            break;
+        case 'p':
+            if ((policy = parse_policy(optarg)) < 0)
+                return 1;
+            break;
+        case 'w':
+            if (strcmp(optarg, "wb") && strcmp(optarg, "wt"))
+                return 1;
+            write_through = !strcmp(optarg, "wt");
+            show_traffic = 1;
+            break;
+        case 'a':
+            if (strcmp(optarg, "wa") && strcmp(optarg, "nwa"))
+                return 1;
+            no_write_allocate = !strcmp(optarg, "nwa");
+            show_traffic = 1;
             break;
         default:
             return 1;
@@ -87,193 +590,3492 @@ int main(int argc, char* argv[])
 
     }
 
-    if (!file)
+    int sampled = sampling.set_ratio || sampling.window;
+
+    if (!have_trace && (!synthetic || sweep_mode || nlevels || cores.n))
 
     {
         return 1;
     }
 
-    else if (!cache.s || !cache.b || !cache.E)
+    else if (threads < 1)
 
     {
         return 1;
     }
 
-    cache.sets = malloc(sizeof(set) * (1 << cache.s));
+    // the TLB sits in front of the one data cache and sees every access
+    else if (translation.page_shift && (threads > 1 || sweep_mode || nlevels || cores.n
+                                        || sampled || coalesce))
+
+    {
+        return 1;
+    }
 
-    for (int i = 0; i < (1 << cache.s); i++)
+    // sampling only estimates the plain hit/miss/eviction counts
+    else if (sampled && (verbose || threads > 1 || sweep_mode || nlevels || classify || synthetic
+                         || show_traffic || policy == POLICY_OPT))
 
     {
-        cache.sets[i].lines = malloc(sizeof(line) * cache.E);
+        return 1;
     }
 
-    char op;
-    unsigned long long address;
+    else if (sweep_mode)
 
-    int size = 0;
+    {
+        // stack distances describe plain LRU only
+        if (policy != POLICY_LRU || no_write_allocate || classify || prefetch.kind || cores.n
+            || coalesce || threads > 1)
+            return 1;
+        int failed = !s_list || !b_list || cache.E < 1 || sweep(&file, s_list, cache.E, b_list);
+        close_trace(&file);
+        return failed;
+    }
 
-    while (fscanf(file, " %c %llx,%d", &op, &address, &size) != EOF)
+    else if (nlevels)
 
     {
-        switch (op)
+        if (verbose || threads > 1 || policy == POLICY_OPT || classify || prefetch.kind
+            || cores.n || coalesce)
+            return 1;
+        for (int i = 0; i < nlevels; i++)
         {
-        case 'L':
-        case 'S':
-            if (verbose)
-            {
-                printf("%c %llx, %d ", op, address, size);
-            }
-            update(&cache, verbose, address, &hit, &miss, &eviction);
-            if (verbose) printf("\n");
-            break;
-
-        case 'M':
-            if (verbose)
+            levels[i].cache.policy = policy;
+            levels[i].cache.write_through = write_through;
+            levels[i].cache.no_write_allocate = no_write_allocate;
+        }
+        select_tag_kernel();
+        int failed = simulate_hierarchy(&file, levels, nlevels, memory_latency);
+        close_trace(&file);
+        return failed;
+    }
 
-            {
-                printf("%c %llx, %d ", op, address, size);
-            }
-            update(&cache, verbose, address, &hit, &miss, &eviction);
-            update(&cache, verbose, address, &hit, &miss, &eviction);
+    else if (cores.n)
 
-            if (verbose) printf("\n");
-            break;
-        }
+    {
+        // the protocol needs write-back, write-allocate caches and serial order;
+        // binary traces carry no thread ids, so every access would land on cache 0
+        if (verbose || threads > 1 || policy == POLICY_OPT || classify || prefetch.kind
+            || sweep_mode || sampled || write_through || no_write_allocate || coalesce
+            || file.binary)
+            return 1;
+        for (int i = 0; i < cores.n; i++)
+            cores.cores[i].cache.policy = policy;
+        select_tag_kernel();
+
+        unsigned long long accesses = 0;
+        double start = now_sec();
+        int failed = !cache.s || !cache.b || !cache.E
+                  || init_coherence(&cores, cache.s, cache.E, cache.b)
+                  || simulate_coherence(&file, &cores, &accesses);
+        double elapsed = now_sec() - start;
+
+        if (report && !failed)
+            fprintf(stderr, "accesses:%llu time:%.3fs rate:%.0f accesses/sec\n",
+                    accesses, elapsed, elapsed > 0 ? accesses / elapsed : 0.0);
+        free_coherence(&cores);
+        close_trace(&file);
+        return failed;
     }
 
-    printSummary(hit, miss, eviction);
+    else if (!cache.s || !cache.b || !cache.E)
 
-    //free
+    {
+        return 1;
+    }
 
-    fclose(file);
-    for (int i = 0; i << (1 << cache.s); i++)
+    else if (threads > 1 && verbose) // verbose needs trace order
 
     {
-        free(cache.sets[i].lines);
+        return 1;
     }
 
-    free(cache.sets);
-    
-    return 0;
+    else if (threads > 1 && (policy == POLICY_OPT || classify)) // both need the whole trace
 
-}
+    {
+        return 1;
+    }
 
+    else if (synthetic && (threads > 1 || classify || verbose || policy == POLICY_OPT))
 
+    {
+        return 1;
+    }
 
-int check_hit(set* cache_set, int n, int tag, int* hit)
+    // prefetches cross sets and add accesses, so only the plain serial run
+    else if (prefetch.kind && (threads > 1 || classify || synthetic || sampled
+                               || policy == POLICY_OPT))
 
-{
+    {
+        return 1;
+    }
+
+    // OPT stamps every access; the others only run the plain serial loop
+    else if (coalesce && (verbose || threads > 1 || classify || synthetic || sampled
+                          || prefetch.kind || policy == POLICY_OPT))
 
-    for (int i = 0; i < n; i++)
     {
+        return 1;
+    }
 
-        line* cache_line = &cache_set->lines[i];
+    if (threads > (1 << cache.s))
+        threads = 1 << cache.s;
 
-        if ((cache_line->valid) && (cache_line->tag == tag))
+    select_tag_kernel();
 
-        {
-            (*hit)++;
-            cache_line->count_LRU = 0;
-            return 1;
-        }
-    }
-    return 0;
+    cache.policy = policy;
+    cache.write_through = write_through;
+    cache.no_write_allocate = no_write_allocate;
+    cache.prefetch = prefetch.kind ? &prefetch : 0;
+    if (init_cache(&cache))
+        return 1;
 
-}
+    if (translation.page_shift && init_tlb(&translation))
+        return 1;
+    cache.tlb = translation.page_shift ? &translation : 0;
+
+    if (policy == POLICY_OPT && prepare_opt(&cache, &file))
+        return 1;
 
+    if (classify && init_three_c(&classes, &cache))
+        return 1;
 
+    if (sampled && init_sampler(&sampling, &cache))
+        return 1;
 
-int check_miss(set* cache_set, int n, int tag, int* miss)
+    double parse = report && !synthetic ? time_parse(&file) : 0;
+    unsigned long long accesses = 0;
+    double start = now_sec();
 
-{
+    if (threads > 1)
+    {
+        if (simulate_sharded(&cache, &file, threads, &hit, &miss, &eviction, &accesses))
+            return 1;
+    }
+    else if (synthetic)
+        synthetic_failed = simulate_synthetic(&cache, synthetic, &hit, &miss, &eviction, &accesses);
+    else if (classify)
+        simulate_three_c(&classes, &cache, &file, verbose, &hit, &miss, &eviction, &accesses);
+    else if (sampled)
+        simulate_sampled(&sampling, &cache, &file, &accesses);
+    else if (coalesce)
+        simulate_coalesced(&cache, &file, &hit, &miss, &eviction, &accesses, &references);
+    else
+        simulate(&cache, &file, verbose, &hit, &miss, &eviction, &accesses);
+
+    double elapsed = now_sec() - start;
+
+    if (verbose && flush_events())
+        synthetic_failed = 1;
+    close_event_log();
+
+    if (sampled)
+        print_sampled(&sampling, &cache);
+    else
+        print_summary(hit, miss, eviction);
+
+    if (show_traffic)
 
-    (*miss)++;
+    {
+        printf("dirty-evictions:%llu bytes-read:%llu bytes-written:%llu\n",
+               cache.dirty_evictions, cache.bytes_read, cache.bytes_written);
+    }
 
-    for (int i = 0; i < n; i++)
+    if (prefetch.kind)
+        print_prefetch(&prefetch, miss);
 
+    if (translation.page_shift)
     {
-        line* cache_line = &cache_set->lines[i];
-        if (!cache_line->valid)
+        print_tlb(&translation);
+        free_tlb(&translation);
+    }
 
-        {
-            cache_line->valid = 1;
-            cache_line->tag = tag;
-            cache_line->count_LRU = 0;
-            return 1;
-        }
+    if (classify)
+
+    {
+        print_three_c(&classes, &cache);
+        free_three_c(&classes);
     }
-    return 0;
+
+    if (report)
+
+    {
+        // the parse-only pass was timed separately; the rest is simulation
+        fprintf(stderr, "accesses:%llu time:%.3fs rate:%.0f accesses/sec"
+                " parse:%.3fs simulate:%.3fs ns/access:%.1f\n",
+                accesses, elapsed, elapsed > 0 ? accesses / elapsed : 0.0,
+                parse, elapsed > parse ? elapsed - parse : 0.0,
+                accesses ? elapsed * 1e9 / accesses : 0.0);
+        if (coalesce)
+            fprintf(stderr, "references:%llu (%.1f%% of accesses)\n", references,
+                    accesses ? 100.0 * references / accesses : 0.0);
+    }
+
+    //free
+
+    close_trace(&file);
+    free_cache(&cache);
+
+    return synthetic_failed;
+
 }
 
+#endif
 
 
-int check_eviction(set* cache_set, int E, int tag, int* eviction)
+
+int init_cache(Cache* cache)
 
 {
 
-    (*eviction)++;
+    size_t n = (size_t)1 << cache->s;
 
-    int max_index = 0;
-    int max_LRU = cache_set->lines[0].count_LRU;
+    cache->ways = (cache->E + TAG_CHUNK - 1) / TAG_CHUNK * TAG_CHUNK;
+    cache->valid_words = (cache->E + 63) / 64;
+    cache->clock = 0;
+    cache->opt_next = 0;
 
+    if (cache->s + cache->b >= 64 || cache->s > 40)
+        return 1;
 
-    for (int i = 1; i < E; i++)
+    // the PLRU tree needs a power-of-two E and fits 63 nodes in set.state
+    if (cache->policy == POLICY_PLRU && ((cache->E & (cache->E - 1)) || cache->E > 64))
+        return 1;
+
+    cache->sets = calloc(n, sizeof(set));
+    cache->use_store = calloc(n * cache->ways, sizeof(unsigned long long));
+    cache->valid_store = calloc(n * cache->valid_words, sizeof(unsigned long long));
+    cache->dirty_store = calloc(n * cache->valid_words, sizeof(unsigned long long));
+    if (cache->prefetch)
+        cache->prefetched_store = calloc(n * cache->valid_words, sizeof(unsigned long long));
+    // 32-byte aligned so every vector load in find_tag is aligned
+    if (posix_memalign((void**)&cache->tag_store, 32, n * cache->ways * sizeof(unsigned long long)))
+        cache->tag_store = 0;
+
+    if (!cache->sets || !cache->use_store || !cache->valid_store || !cache->dirty_store
+        || !cache->tag_store || (cache->prefetch && !cache->prefetched_store))
     {
-        line* cache_line = &cache_set->lines[i];
-        if (cache_line->count_LRU > max_LRU)
-        {
-            max_LRU = cache_line->count_LRU;
-            max_index = i;
-        }
+        free_cache(cache);
+        return 1;
     }
 
-    line* max_line = &cache_set->lines[max_index];
-    
-    max_line->tag = tag;
-    max_line->count_LRU = 0;
+    for (size_t i = 0; i < n; i++)
+
+    {
+        cache->sets[i].tags = cache->tag_store + i * cache->ways;
+        cache->sets[i].last_use = cache->use_store + i * cache->ways;
+        cache->sets[i].valid = cache->valid_store + i * cache->valid_words;
+        cache->sets[i].dirty = cache->dirty_store + i * cache->valid_words;
+        if (cache->prefetch)
+            cache->sets[i].prefetched = cache->prefetched_store + i * cache->valid_words;
+    }
 
     return 0;
 }
 
 
 
-void update(Cache* cache, int verbose, int address, int* hit, int* miss, int* eviction)
+void free_cache(Cache* cache)
 
 {
 
-    int set_index = (address >> cache->b) & (~(~0 << cache->s));
-    int tag = (~0) & (address >> (cache->b + cache->s));
-
-    set* cache_set = &cache->sets[set_index];
+    free(cache->sets);
+    free(cache->tag_store);
+    free(cache->use_store);
+    free(cache->valid_store);
+    free(cache->dirty_store);
+    free(cache->prefetched_store);
+    free(cache->opt_next);
+    free(cache->sampled);
+    cache->sets = 0;
+    cache->sampled = 0;
+    cache->opt_next = 0;
+    cache->tag_store = 0;
+    cache->use_store = 0;
+    cache->valid_store = 0;
+    cache->dirty_store = 0;
+    cache->prefetched_store = 0;
+}
 
 
-    for (int i = 0; i < cache->E; i++)
 
-    {
+// tag-compare kernels: each returns the first valid way holding tag, or -1
 
-        line* cache_line = &cache_set->lines[i];
-        if (cache_line->valid)
-        {
-            (cache_line->count_LRU)++;
-        }
-        else cache_line->count_LRU = 0;
+static int find_tag_scalar(set* cache_set, int ways, unsigned long long tag)
 
-    }
+{
 
-    if (check_hit(cache_set, cache->E, tag, hit))
+    for (int i = 0; i < ways; i++)
     {
-        if (verbose) printf("hit ");
-        return;
+        if (((cache_set->valid[i >> 6] >> (i & 63)) & 1) && cache_set->tags[i] == tag)
+            return i;
     }
-    else if (check_miss(cache_set, cache->E, tag, miss))
+    return -1;
+}
+
+
+
+#ifdef HAVE_X86_SIMD
+
+// SSE2 has no 64-bit compare: both 32-bit halves must match
+__attribute__((target("sse2")))
+static int find_tag_sse2(set* cache_set, int ways, unsigned long long tag)
+
+{
+
+    __m128i key = _mm_set1_epi64x(tag);
+
+    for (int i = 0; i < ways; i += TAG_CHUNK)
     {
-        if (verbose) printf("miss ");
-        return;
+        unsigned match = 0;
+
+        for (int k = 0; k < TAG_CHUNK; k += 2)
+        {
+            __m128i eq = _mm_cmpeq_epi32(_mm_load_si128((__m128i*)(cache_set->tags + i + k)), key);
+            eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+            match |= _mm_movemask_pd(_mm_castsi128_pd(eq)) << k;
+        }
+
+        match &= cache_set->valid[i >> 6] >> (i & 63);
+        if (match)
+            return i + __builtin_ctz(match);
     }
-    check_eviction(cache_set, cache->E, tag, eviction);
-     if (verbose) printf("eviction ");
-        return;
+    return -1;
 }
 
 
 
+__attribute__((target("avx2")))
+static int find_tag_avx2(set* cache_set, int ways, unsigned long long tag)
+
+{
+
+    __m256i key = _mm256_set1_epi64x(tag);
+
+    for (int i = 0; i < ways; i += TAG_CHUNK)
+    {
+        __m256i lo = _mm256_load_si256((__m256i*)(cache_set->tags + i));
+        __m256i hi = _mm256_load_si256((__m256i*)(cache_set->tags + i + 4));
+        unsigned match = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(lo, key)))
+                       | _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(hi, key))) << 4;
+
+        match &= cache_set->valid[i >> 6] >> (i & 63);
+        if (match)
+            return i + __builtin_ctz(match);
+    }
+    return -1;
+}
+
+#endif
+
+
+
+enum { TAG_SCALAR, TAG_SSE2, TAG_AVX2 };
+
+static int tag_kernel = TAG_SCALAR;
+
+
+
+static void select_tag_kernel(void)
+
+{
+
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        tag_kernel = TAG_AVX2;
+    else if (__builtin_cpu_supports("sse2"))
+        tag_kernel = TAG_SSE2;
+#endif
+    if (getenv("CSIM_SCALAR")) // force the portable path, for comparisons
+        tag_kernel = TAG_SCALAR;
+}
+
+
+
+static inline int find_tag(set* cache_set, int ways, unsigned long long tag)
+
+{
+
+    switch (tag_kernel)
+    {
+#ifdef HAVE_X86_SIMD
+    case TAG_AVX2:
+        return find_tag_avx2(cache_set, ways, tag);
+    case TAG_SSE2:
+        return find_tag_sse2(cache_set, ways, tag);
+#endif
+    default:
+        return find_tag_scalar(cache_set, ways, tag);
+    }
+}
+
+
+
+// ---- replacement policies ----
+//
+// Per-way metadata lives in set.last_use and per-set state in set.state:
+//   lru    last access time          fifo   fill time
+//   random set.state is an RNG       plru   set.state holds the tree bits
+//   nru    reference bit             srrip / brrip   re-reference prediction
+//   opt    time of the block's next reference
+// The hooks take the policy as a compile-time constant; POLICIES() below
+// stamps out one fully inlined update/simulate pair per policy, so the
+// LRU loop carries no code from the others.
+
+#define RRPV_MAX 3
+#define BRRIP_LONG 32 // BRRIP inserts at RRPV_MAX - 1 once every 32 fills of a set
+
+#define ALWAYS_INLINE static inline __attribute__((always_inline))
+
+
+
+static void plru_touch(set* cache_set, int E, int way)
+
+{
+
+    int node = 1;
+
+    // each node bit points to the half holding the next victim
+    for (int span = E >> 1; span; span >>= 1)
+    {
+        int right = (way & span) != 0;
+        if (right)
+            cache_set->state &= ~(1ULL << node);
+        else
+            cache_set->state |= 1ULL << node;
+        node = 2 * node + right;
+    }
+}
+
+
+
+static int plru_victim(set* cache_set, int E)
+
+{
+
+    int node = 1;
+    int way = 0;
+
+    for (int span = E >> 1; span; span >>= 1)
+    {
+        int right = (cache_set->state >> node) & 1;
+        way |= right ? span : 0;
+        node = 2 * node + right;
+    }
+    return way;
+}
+
+
+
+static int random_victim(Cache* cache, set* cache_set)
+
+{
+
+    // per-set xorshift so -j shards draw the same numbers as one thread
+    unsigned long long x = cache_set->state;
+
+    if (!x)
+        x = (unsigned long long)(cache_set - cache->sets + 1) * 0x9E3779B97F4A7C15ULL;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    cache_set->state = x;
+    return (x * 0x2545F4914F6CDD1DULL >> 32) % cache->E;
+}
+
+
+
+static int nru_victim(set* cache_set, int E)
+
+{
+
+    for (int i = 0; i < E; i++)
+    {
+        if (!cache_set->last_use[i])
+            return i;
+    }
+    for (int i = 0; i < E; i++)
+        cache_set->last_use[i] = 0;
+    return 0;
+}
+
+
+
+static int rrip_victim(set* cache_set, int E)
+
+{
+
+    int way = 0;
+    unsigned long long max_rrpv = cache_set->last_use[0];
+
+    for (int i = 1; i < E; i++)
+    {
+        if (cache_set->last_use[i] > max_rrpv)
+        {
+            max_rrpv = cache_set->last_use[i];
+            way = i;
+        }
+    }
+
+    // age everyone at once until the first way reaches RRPV_MAX
+    if (max_rrpv < RRPV_MAX)
+    {
+        for (int i = 0; i < E; i++)
+            cache_set->last_use[i] += RRPV_MAX - max_rrpv;
+    }
+    return way;
+}
+
+
+
+// way with the smallest (lru, fifo) or largest (opt) metadata
+static int oldest_way(set* cache_set, int E, int largest)
+
+{
+
+    int way = 0;
+    unsigned long long best = cache_set->last_use[0];
+
+    for (int i = 1; i < E; i++)
+    {
+        unsigned long long v = cache_set->last_use[i];
+        if (largest ? v > best : v < best)
+        {
+            best = v;
+            way = i;
+        }
+    }
+    return way;
+}
+
+
+
+ALWAYS_INLINE void policy_touch(Cache* cache, set* cache_set, int way, unsigned long long now,
+                                const int policy)
+
+{
+
+    switch (policy)
+    {
+    case POLICY_LRU:
+        cache_set->last_use[way] = now;
+        break;
+    case POLICY_PLRU:
+        plru_touch(cache_set, cache->E, way);
+        break;
+    case POLICY_NRU:
+        cache_set->last_use[way] = 1;
+        break;
+    case POLICY_SRRIP:
+    case POLICY_BRRIP:
+        cache_set->last_use[way] = 0;
+        break;
+    case POLICY_OPT:
+        cache_set->last_use[way] = cache->opt_next[now - 1];
+        break;
+    default: // fifo, random: hits change nothing
+        break;
+    }
+}
+
+
+
+ALWAYS_INLINE void policy_fill(Cache* cache, set* cache_set, int way, unsigned long long now,
+                               const int policy)
+
+{
+
+    switch (policy)
+    {
+    case POLICY_FIFO:
+        cache_set->last_use[way] = now;
+        break;
+    case POLICY_SRRIP:
+        cache_set->last_use[way] = RRPV_MAX - 1;
+        break;
+    case POLICY_BRRIP:
+        cache_set->last_use[way] = ++cache_set->state % BRRIP_LONG ? RRPV_MAX : RRPV_MAX - 1;
+        break;
+    default:
+        policy_touch(cache, cache_set, way, now, policy);
+        break;
+    }
+}
+
+
+
+ALWAYS_INLINE int policy_victim(Cache* cache, set* cache_set, const int policy)
+
+{
+
+    switch (policy)
+    {
+    case POLICY_RANDOM:
+        return random_victim(cache, cache_set);
+    case POLICY_PLRU:
+        return plru_victim(cache_set, cache->E);
+    case POLICY_NRU:
+        return nru_victim(cache_set, cache->E);
+    case POLICY_SRRIP:
+    case POLICY_BRRIP:
+        return rrip_victim(cache_set, cache->E);
+    case POLICY_OPT:
+        return oldest_way(cache_set, cache->E, 1);
+    default: // lru, fifo
+        return oldest_way(cache_set, cache->E, 0);
+    }
+}
+
+
+
+// a store of `store` bytes to a resident way: dirty it (write-back) or
+// pass the bytes on (write-through)
+static inline void write_way(Cache* cache, set* cache_set, int way, int store)
+
+{
+
+    if (!store)
+        return;
+    if (cache->write_through)
+        cache->bytes_written += store;
+    else
+        cache_set->dirty[way >> 6] |= 1ULL << (way & 63);
+}
+
+
+
+// bring a block into `way`: fetch it from the next level and apply the store
+static inline void fill_way(Cache* cache, set* cache_set, int way, unsigned long long tag,
+                            int store)
+
+{
+
+    cache_set->tags[way] = tag;
+    cache_set->dirty[way >> 6] &= ~(1ULL << (way & 63));
+    if (cache->prefetch)
+        cache_set->prefetched[way >> 6] &= ~(1ULL << (way & 63));
+    cache->bytes_read += 1ULL << cache->b;
+    write_way(cache, cache_set, way, store);
+}
+
+
+
+ALWAYS_INLINE int check_hit(Cache* cache, set* cache_set, unsigned long long tag, int store,
+                            unsigned long long* hit, unsigned long long now, const int policy)
+
+{
+
+    int way = find_tag(cache_set, cache->ways, tag);
+
+    if (way >= 0)
+
+    {
+        (*hit)++;
+        if (cache->prefetch && (cache_set->prefetched[way >> 6] >> (way & 63)) & 1)
+        {
+            cache_set->prefetched[way >> 6] &= ~(1ULL << (way & 63));
+            cache->prefetch->hits++;
+            cache->prefetch->tagged = 1;
+        }
+        policy_touch(cache, cache_set, way, now, policy);
+        write_way(cache, cache_set, way, store);
+        return 1;
+    }
+    return 0;
+
+}
+
+
+
+// fills the first invalid way, if there is one; a no-write-allocate store
+// miss goes straight to the next level and counts as handled
+ALWAYS_INLINE int check_miss(Cache* cache, set* cache_set, unsigned long long tag, int store,
+                             unsigned long long* miss, unsigned long long now, const int policy)
+
+{
+
+    (*miss)++;
+
+    if (store && cache->no_write_allocate)
+    {
+        cache->bytes_written += store;
+        return 1;
+    }
+
+    for (int w = 0; w < cache->valid_words; w++)
+
+    {
+        unsigned long long empty = ~cache_set->valid[w];
+        int victim = w * 64 + (empty ? __builtin_ctzll(empty) : 64);
+
+        if (empty && victim < cache->E)
+        {
+            cache_set->valid[w] |= 1ULL << (victim & 63);
+            fill_way(cache, cache_set, victim, tag, store);
+            policy_fill(cache, cache_set, victim, now, policy);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+
+ALWAYS_INLINE int check_eviction(Cache* cache, set* cache_set, int set_index,
+                                 unsigned long long tag, int store, unsigned long long* eviction,
+                                 unsigned long long now, const int policy)
+
+{
+
+    (*eviction)++;
+
+    int victim = policy_victim(cache, cache_set, policy);
+
+    cache->victim_dirty = (cache_set->dirty[victim >> 6] >> (victim & 63)) & 1;
+    if (cache->victim_dirty)
+    {
+        cache->dirty_evictions++;
+        cache->bytes_written += 1ULL << cache->b;
+    }
+
+    if (cache->prefetch && (cache_set->prefetched[victim >> 6] >> (victim & 63)) & 1)
+        cache->prefetch->useless++;
+
+    cache->victim_address = cache_set->tags[victim] << (cache->b + cache->s)
+                          | (unsigned long long)set_index << cache->b;
+    fill_way(cache, cache_set, victim, tag, store);
+    policy_fill(cache, cache_set, victim, now, policy);
+
+    return 0;
+}
+
+
+
+// ---- -P hardware prefetchers ----
+//
+// Prefetches go through check_miss / check_eviction like a demand fill,
+// but are charged to the prefetcher's own counters. A prefetched way
+// keeps its bit in set.prefetched until a demand hit uses it (a prefetch
+// hit) or it is evicted first (a useless prefetch).
+
+// <next|stride|stream>[,<degree>[,<distance>]]
+int parse_prefetch(const char* spec, prefetcher* pf)
+
+{
+
+    char kind[16];
+
+    pf->degree = 1;
+    pf->distance = 1;
+    int n = sscanf(spec, "%15[a-z],%d,%d", kind, &pf->degree, &pf->distance);
+
+    if (n < 1 || pf->degree < 1 || pf->distance < 1)
+        return 1;
+
+    if (!strcmp(kind, "next"))
+        pf->kind = PREFETCH_NEXT;
+    else if (!strcmp(kind, "stride"))
+        pf->kind = PREFETCH_STRIDE;
+    else if (!strcmp(kind, "stream"))
+        pf->kind = PREFETCH_STREAM;
+    else
+        return 1;
+    return 0;
+}
+
+
+
+// fetch `block` unless it is already cached; the demand access' victim
+// stays in Cache.victim_address
+ALWAYS_INLINE void prefetch_block(Cache* cache, unsigned long long block, const int policy)
+
+{
+
+    prefetcher* pf = cache->prefetch;
+    unsigned long long address = block << cache->b;
+    int set_index = set_index_of(cache, address);
+    unsigned long long tag = address >> (cache->b + cache->s);
+    set* cache_set = &cache->sets[set_index];
+    unsigned long long victim = cache->victim_address;
+    int victim_dirty = cache->victim_dirty;
+    unsigned long long filled = 0;
+
+    if (find_tag(cache_set, cache->ways, tag) >= 0)
+        return;
+
+    unsigned long long now = ++cache->clock;
+    if (!check_miss(cache, cache_set, tag, 0, &filled, now, policy))
+        check_eviction(cache, cache_set, set_index, tag, 0, &pf->evictions, now, policy);
+
+    int way = find_tag(cache_set, cache->ways, tag);
+    cache_set->prefetched[way >> 6] |= 1ULL << (way & 63);
+    cache->victim_address = victim;
+    cache->victim_dirty = victim_dirty;
+    pf->issued++;
+}
+
+
+
+static pf_entry* pf_find(prefetcher* pf, unsigned long long key)
+
+{
+
+    for (int i = 0; i < PF_TABLE; i++)
+        if (pf->table[i].used && pf->table[i].key == key)
+        {
+            pf->table[i].used = ++pf->clock;
+            return &pf->table[i];
+        }
+    return 0;
+}
+
+
+
+// reset the least recently used entry for `key`
+static pf_entry* pf_claim(prefetcher* pf, unsigned long long key)
+
+{
+
+    pf_entry* e = &pf->table[0];
+
+    for (int i = 1; i < PF_TABLE; i++)
+        if (pf->table[i].used < e->used)
+            e = &pf->table[i];
+
+    memset(e, 0, sizeof(pf_entry));
+    e->key = key;
+    e->used = ++pf->clock;
+    return e;
+}
+
+
+
+// train on a demand access and issue `degree` prefetches, the first one
+// `distance` steps ahead. Traces carry no PC, so the stride prefetcher
+// keys on the 4KB region. A stream is keyed on the block it expects
+// next, with its direction in stride.
+ALWAYS_INLINE void prefetch_access(Cache* cache, unsigned long long address, int result,
+                                   const int policy)
+
+{
+
+    prefetcher* pf = cache->prefetch;
+    unsigned long long block = address >> cache->b;
+    int trigger = result != RESULT_HIT || pf->tagged; // a miss or the first use of a prefetch
+    long long step = 0;
+
+    pf->tagged = 0;
+
+    switch (pf->kind)
+    {
+    case PREFETCH_NEXT:
+        step = trigger;
+        break;
+
+    case PREFETCH_STRIDE:
+    {
+        pf_entry* e = pf_find(pf, address >> PF_REGION_BITS);
+        long long delta = e ? (long long)(block - e->last) : 0;
+
+        if (!e)
+            e = pf_claim(pf, address >> PF_REGION_BITS);
+        else if (delta == e->stride)
+            e->confidence += e->confidence < PF_CONFIDENT;
+        else if (delta)
+        {
+            e->stride = delta;
+            e->confidence = 0;
+        }
+        e->last = block;
+        step = delta && e->confidence >= PF_CONFIDENT ? e->stride : 0;
+        break;
+    }
+
+    case PREFETCH_STREAM:
+    {
+        if (!trigger)
+            break;
+        pf_entry* e = pf_find(pf, block);
+        if (e)
+        {
+            e->confidence += e->confidence < PF_CONFIDENT;
+            e->key = block + e->stride;
+            step = e->confidence >= PF_CONFIDENT ? e->stride : 0;
+        }
+        else
+        {
+            // a miss outside every stream starts a candidate in each direction
+            pf_claim(pf, block + 1)->stride = 1;
+            pf_claim(pf, block - 1)->stride = -1;
+        }
+        break;
+    }
+    }
+
+    for (int k = 0; step && k < pf->degree; k++)
+        prefetch_block(cache, block + step * (pf->distance + k), policy);
+}
+
+
+
+void print_prefetch(prefetcher* pf, unsigned long long miss)
+
+{
+
+    printf("prefetches:%llu prefetch-hits:%llu useless-prefetches:%llu prefetch-evictions:%llu"
+           " accuracy:%.3f coverage:%.3f\n",
+           pf->issued, pf->hits, pf->useless, pf->evictions,
+           pf->issued ? (double)pf->hits / pf->issued : 0.0,
+           pf->hits + miss ? (double)pf->hits / (pf->hits + miss) : 0.0);
+}
+
+
+
+// ---- -v / -e event output ----
+//
+// Verbose text and binary events are formatted into fixed buffers and
+// handed to write() a chunk at a time, instead of several printf calls
+// per access. flush_events must run before anything else goes to stdout.
+
+#define EVENT_BUFFER (1 << 16)
+#define EVENT_SLACK 64 // longer than any one record's text
+
+typedef struct
+{
+    char text[EVENT_BUFFER];
+    size_t text_len;
+    csim_event log[EVENT_BUFFER / sizeof(csim_event)];
+    size_t log_len;
+    int log_fd;
+    unsigned long long index; // records begun so far
+    int failed;               // a write() failed, later output is dropped
+} event_sink;
+
+static event_sink events;
+
+
+
+static void write_all(int fd, const void* data, size_t length)
+
+{
+
+    const char* p = data;
+
+    while (length && !events.failed)
+    {
+        ssize_t n = write(fd, p, length);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            events.failed = 1;
+            return;
+        }
+        p += n;
+        length -= n;
+    }
+}
+
+
+
+// returns 1 if some output was lost
+int flush_events(void)
+
+{
+
+    write_all(STDOUT_FILENO, events.text, events.text_len);
+    events.text_len = 0;
+    if (events.log_len)
+        write_all(events.log_fd, events.log, events.log_len * sizeof(csim_event));
+    events.log_len = 0;
+    return events.failed;
+}
+
+
+
+int open_event_log(const char* path)
+
+{
+
+    events.log_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (events.log_fd < 0)
+        return 1;
+    write_all(events.log_fd, EVENT_MAGIC, EVENT_MAGIC_LEN);
+    return events.failed;
+}
+
+
+
+void close_event_log(void)
+
+{
+
+    if (events.log_fd > 0)
+        close(events.log_fd);
+    events.log_fd = 0;
+}
+
+
+
+static void emit_text(const char* s, size_t length)
+
+{
+
+    memcpy(events.text + events.text_len, s, length);
+    events.text_len += length;
+}
+
+
+
+// "<op> <hex address>, <size> " at the start of a verbose line
+static void event_begin(int verbose, char op, unsigned long long address, int size)
+
+{
+
+    events.index++;
+    if (!(verbose & VERBOSE_TEXT))
+        return;
+
+    if (events.text_len > EVENT_BUFFER - EVENT_SLACK)
+        flush_events();
+
+    char digits[24];
+    char* p = digits + sizeof(digits);
+    unsigned n = size < 0 ? -(unsigned)size : (unsigned)size;
+    char* t = events.text + events.text_len;
+
+    *t++ = op;
+    *t++ = ' ';
+    do
+        *--p = "0123456789abcdef"[address & 15];
+    while (address >>= 4);
+    memcpy(t, p, digits + sizeof(digits) - p);
+    t += digits + sizeof(digits) - p;
+    *t++ = ',';
+    *t++ = ' ';
+    if (size < 0)
+        *t++ = '-';
+    p = digits + sizeof(digits);
+    do
+        *--p = '0' + n % 10;
+    while (n /= 10);
+    memcpy(t, p, digits + sizeof(digits) - p);
+    t += digits + sizeof(digits) - p;
+    *t++ = ' ';
+    events.text_len = t - events.text;
+}
+
+
+
+static void event_end(int verbose)
+
+{
+
+    if (verbose & VERBOSE_TEXT)
+        emit_text("\n", 1);
+}
+
+
+
+// one update() outcome of the current record
+static void event_result(int verbose, int set_index, int result)
+
+{
+
+    static const char* names[] = { "hit ", "miss ", "eviction " };
+    static const size_t lengths[] = { 4, 5, 9 };
+
+    if (verbose & VERBOSE_TEXT)
+        emit_text(names[result], lengths[result]);
+
+    if (verbose & VERBOSE_LOG)
+    {
+        csim_event* e = &events.log[events.log_len++];
+        e->index = events.index - 1;
+        e->set = set_index;
+        e->result = result;
+        if (events.log_len == sizeof(events.log) / sizeof(csim_event))
+            flush_events();
+    }
+}
+
+
+
+// store is the number of bytes written, 0 for a load
+ALWAYS_INLINE int update_policy(Cache* cache, int verbose, unsigned long long address, int store,
+                                unsigned long long* hit, unsigned long long* miss,
+                                unsigned long long* eviction, const int policy)
+
+{
+
+    int set_index = set_index_of(cache, address);
+    if (cache->sampled && !cache->sampled[set_index])
+        return RESULT_SKIPPED;
+    unsigned long long tag = address >> (cache->b + cache->s);
+
+    set* cache_set = &cache->sets[set_index];
+    unsigned long long now = ++cache->clock;
+    int result = RESULT_EVICTION;
+
+    if (check_hit(cache, cache_set, tag, store, hit, now, policy))
+        result = RESULT_HIT;
+    else if (check_miss(cache, cache_set, tag, store, miss, now, policy))
+        result = RESULT_MISS;
+    else
+        check_eviction(cache, cache_set, set_index, tag, store, eviction, now, policy);
+
+    if (verbose)
+        event_result(verbose, set_index, result);
+    if (cache->prefetch)
+        prefetch_access(cache, address, result, policy);
+    return result;
+}
+
+
+
+ALWAYS_INLINE void simulate_policy(Cache* cache, trace* file, int verbose, unsigned long long* hit,
+                                   unsigned long long* miss, unsigned long long* eviction,
+                                   unsigned long long* accesses, const int policy)
+
+{
+
+    char op;
+    unsigned long long address;
+    int size = 0;
+
+    while (next_record(file, &op, &address, &size))
+
+    {
+        int store = size > 0 ? size : 1;
+
+        // one translation per record, an M's load and store share it
+        if (cache->tlb && (op == 'L' || op == 'S' || op == 'M'))
+            tlb_access(cache->tlb, address);
+
+        switch (op)
+        {
+        case 'L':
+        case 'S':
+            if (verbose)
+            {
+                event_begin(verbose, op, address, size);
+            }
+            update_policy(cache, verbose, address, op == 'S' ? store : 0, hit, miss, eviction,
+                          policy);
+            if (verbose) event_end(verbose);
+            (*accesses)++;
+            break;
+
+        case 'M':
+            if (verbose)
+
+            {
+                event_begin(verbose, op, address, size);
+            }
+            update_policy(cache, verbose, address, 0, hit, miss, eviction, policy);
+            update_policy(cache, verbose, address, store, hit, miss, eviction, policy);
+
+            if (verbose) event_end(verbose);
+            (*accesses)++;
+            break;
+        }
+    }
+}
+
+
+
+#define DEFINE_POLICY(name, id)                                                              \
+    static int update_##name(Cache* cache, int verbose, unsigned long long address,          \
+                             int store, unsigned long long* hit, unsigned long long* miss,   \
+                             unsigned long long* eviction)                                   \
+    {                                                                                        \
+        return update_policy(cache, verbose, address, store, hit, miss, eviction, id);       \
+    }                                                                                        \
+    static void simulate_##name(Cache* cache, trace* file, int verbose,                      \
+                                unsigned long long* hit, unsigned long long* miss,           \
+                                unsigned long long* eviction, unsigned long long* accesses)  \
+    {                                                                                        \
+        simulate_policy(cache, file, verbose, hit, miss, eviction, accesses, id);            \
+    }
+
+POLICIES(DEFINE_POLICY)
+
+
+
+int update(Cache* cache, int verbose, unsigned long long address, int store,
+           unsigned long long* hit, unsigned long long* miss, unsigned long long* eviction)
+
+{
+
+#define DISPATCH_UPDATE(name, id) \
+    case id: return update_##name(cache, verbose, address, store, hit, miss, eviction);
+
+    switch (cache->policy)
+    {
+    POLICIES(DISPATCH_UPDATE)
+    }
+    return RESULT_HIT;
+}
+
+
+
+// run the whole trace through the loop specialized for cache->policy
+void simulate(Cache* cache, trace* file, int verbose, unsigned long long* hit,
+              unsigned long long* miss, unsigned long long* eviction, unsigned long long* accesses)
+
+{
+
+#define DISPATCH_SIMULATE(name, id) \
+    case id: simulate_##name(cache, file, verbose, hit, miss, eviction, accesses); break;
+
+    switch (cache->policy)
+    {
+    POLICIES(DISPATCH_SIMULATE)
+    }
+}
+
+
+
+int parse_policy(const char* name)
+
+{
+
+    for (int i = 0; i < POLICY_COUNT; i++)
+    {
+        if (!strcmp(name, policy_names[i]))
+            return i;
+    }
+    return -1;
+}
+
+
+
+// error exit of prepare_opt: drop the next-use map and the partial array
+static int opt_failed(Cache* cache, block_map* last)
+
+{
+
+    free(last->entries);
+    free(cache->opt_next);
+    cache->opt_next = 0;
+    return 1;
+}
+
+
+
+// OPT needs to know when each access' block is referenced next: one
+// forward pass over the trace fills cache->opt_next, then it is rewound
+int prepare_opt(Cache* cache, trace* file)
+
+{
+
+    block_map last = {};
+    size_t cap = 1 << 16;
+    unsigned long long n = 0;
+    char op;
+    unsigned long long address;
+    int size;
+
+    cache->opt_next = malloc(cap * sizeof(unsigned long long));
+    if (!cache->opt_next || map_init(&last))
+        return opt_failed(cache, &last);
+
+    while (next_record(file, &op, &address, &size))
+
+    {
+        int count = op == 'M' ? 2 : (op == 'L' || op == 'S');
+        unsigned long long block = address >> cache->b;
+
+        for (int k = 0; k < count; k++, n++)
+        {
+            if (n == cap)
+            {
+                unsigned long long* grown = realloc(cache->opt_next,
+                                                    (cap *= 2) * sizeof(unsigned long long));
+                if (!grown)
+                    return opt_failed(cache, &last);
+                cache->opt_next = grown;
+            }
+
+            block_entry* e = map_find(&last, block);
+            if (e->used)
+                cache->opt_next[e->value] = n + 1; // times are 1-based like Cache.clock
+            else if (!(e = map_insert(&last, block)))
+                return opt_failed(cache, &last);
+            e->value = n;
+            cache->opt_next[n] = ~0ULL; // never used again
+        }
+    }
+
+    free(last.entries);
+    rewind_trace(file);
+    return 0;
+}
+
+
+
+
+int set_index_of(Cache* cache, unsigned long long address)
+
+{
+    return (address >> cache->b) & ((1ULL << cache->s) - 1);
+}
+
+
+
+// -g scaling check: n sequential loads (8 bytes apart) from a high address, so
+// tags use the upper bits and the counts can pass 2^32. The expected
+// result is known in closed form; returns 1 if the simulation disagrees.
+int simulate_synthetic(Cache* cache, unsigned long long n, unsigned long long* hit,
+                       unsigned long long* miss, unsigned long long* eviction,
+                       unsigned long long* accesses)
+
+{
+
+    unsigned long long base = 0xffff800000000000ULL;
+    unsigned long long stride = cache->b < 3 ? 1ULL << cache->b : 8; // never skip a block
+    unsigned long long per_block = cache->b > 3 ? 1ULL << (cache->b - 3) : 1;
+    unsigned long long lines = (unsigned long long)cache->E << cache->s;
+
+    for (unsigned long long i = 0; i < n; i++)
+    {
+        if (cache->tlb)
+            tlb_access(cache->tlb, base + stride * i);
+        update(cache, 0, base + stride * i, 0, hit, miss, eviction);
+    }
+    *accesses = n;
+
+    unsigned long long want_miss = (n + per_block - 1) / per_block;
+    unsigned long long want_eviction = want_miss > lines ? want_miss - lines : 0;
+
+    if (*hit == n - want_miss && *miss == want_miss && *eviction == want_eviction)
+        return 0;
+
+    fprintf(stderr, "synthetic check failed: expected hits:%llu misses:%llu evictions:%llu\n",
+            n - want_miss, want_miss, want_eviction);
+    return 1;
+}
+
+
+
+static void* shard_main(void* arg)
+
+{
+
+    shard* sh = arg;
+    ring* q = sh->queue;
+    unsigned head = q->head;
+
+    for (;;)
+    {
+        unsigned tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+
+        if (head == tail)
+        {
+            if (__atomic_load_n(&q->done, __ATOMIC_ACQUIRE)
+                && head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
+                break;
+            sched_yield();
+            continue;
+        }
+
+        while (head != tail)
+        {
+            job* j = &q->slots[head & (RING_SIZE - 1)];
+            for (int k = 0; k < j->count; k++)
+                update(&sh->cache, 0, j->address, k == j->count - 1 ? j->store : 0,
+                       &sh->hit, &sh->miss, &sh->eviction);
+            head++;
+        }
+        __atomic_store_n(&q->head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+
+
+// parse the trace once on this thread and route every reference to the
+// shard that owns its set; sets are independent so the counts are exact
+int simulate_sharded(Cache* cache, trace* file, int threads, unsigned long long* hit,
+                     unsigned long long* miss, unsigned long long* eviction,
+                     unsigned long long* accesses)
+
+{
+
+    shard* shards = calloc(threads, sizeof(shard));
+    unsigned* tails = calloc(threads, sizeof(unsigned));
+    unsigned* limits = calloc(threads, sizeof(unsigned));
+    int started = 0;
+    int failed = 0;
+
+    if (!shards || !tails || !limits)
+        failed = 1;
+
+    for (int i = 0; !failed && i < threads; i++)
+    {
+        shards[i].cache = *cache;
+        shards[i].cache.clock = 0;
+        shards[i].cache.dirty_evictions = 0;
+        shards[i].cache.bytes_read = 0;
+        shards[i].cache.bytes_written = 0;
+        if (posix_memalign((void**)&shards[i].queue, 64, sizeof(ring)))
+        {
+            failed = 1;
+            break;
+        }
+        shards[i].queue->head = shards[i].queue->tail = 0;
+        shards[i].queue->done = 0;
+        if (pthread_create(&shards[i].thread, 0, shard_main, &shards[i]))
+        {
+            free(shards[i].queue);
+            shards[i].queue = 0;
+            failed = 1;
+            break;
+        }
+        started++;
+    }
+
+    char op;
+    unsigned long long address;
+    int size;
+
+    while (!failed && next_record(file, &op, &address, &size))
+
+    {
+        int count;
+
+        if (op == 'L' || op == 'S')
+            count = 1;
+        else if (op == 'M')
+            count = 2;
+        else
+            continue;
+
+        int id = set_index_of(cache, address) % threads;
+        ring* q = shards[id].queue;
+        unsigned t = tails[id];
+
+        // wait for room, re-reading the consumer position only when needed
+        while (t == limits[id])
+        {
+            limits[id] = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) + RING_SIZE;
+            if (t == limits[id])
+                sched_yield();
+        }
+
+        q->slots[t & (RING_SIZE - 1)].address = address;
+        q->slots[t & (RING_SIZE - 1)].count = count;
+        q->slots[t & (RING_SIZE - 1)].store = op == 'L' ? 0 : (size > 0 ? size : 1);
+        tails[id] = ++t;
+        if (!(t % RING_BATCH))
+            __atomic_store_n(&q->tail, t, __ATOMIC_RELEASE);
+        (*accesses)++;
+    }
+
+    for (int i = 0; i < started; i++)
+    {
+        __atomic_store_n(&shards[i].queue->tail, tails[i], __ATOMIC_RELEASE);
+        __atomic_store_n(&shards[i].queue->done, 1, __ATOMIC_RELEASE);
+    }
+
+    for (int i = 0; i < started; i++)
+    {
+        pthread_join(shards[i].thread, 0);
+        *hit += shards[i].hit;
+        *miss += shards[i].miss;
+        *eviction += shards[i].eviction;
+        cache->dirty_evictions += shards[i].cache.dirty_evictions;
+        cache->bytes_read += shards[i].cache.bytes_read;
+        cache->bytes_written += shards[i].cache.bytes_written;
+        free(shards[i].queue);
+    }
+
+    free(shards);
+    free(tails);
+    free(limits);
+    return failed;
+}
+
+
+
+int open_trace(trace* t, const char* path)
+
+{
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0)
+        return 1;
+
+    t->mapped = 0;
+    t->data = 0;
+    t->length = 0;
+
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0)
+
+    {
+        void* p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            posix_madvise(p, st.st_size, POSIX_MADV_SEQUENTIAL);
+            t->data = p;
+            t->length = st.st_size;
+            t->mapped = 1;
+        }
+    }
+
+    if (!t->mapped)
+
+    {
+        // not mappable (pipe, empty file): slurp it instead
+        size_t cap = 1 << 16;
+        ssize_t n;
+
+        t->data = malloc(cap);
+        while (t->data && (n = read(fd, t->data + t->length, cap - t->length)) > 0)
+        {
+            t->length += n;
+            if (t->length == cap)
+            {
+                char* grown = realloc(t->data, cap * 2);
+                if (!grown)
+                {
+                    free(t->data);
+                    t->data = 0;
+                    break;
+                }
+                t->data = grown;
+                cap *= 2;
+            }
+        }
+        if (!t->data)
+        {
+            close(fd);
+            return 1;
+        }
+    }
+
+    close(fd);
+    t->cur = t->data;
+    t->end = t->data + t->length;
+
+    t->binary = t->length >= TRACE_MAGIC_LEN && !memcmp(t->data, TRACE_MAGIC, TRACE_MAGIC_LEN);
+    t->prev_address = 0;
+    t->size_count = 0;
+    if (t->binary)
+        t->cur += TRACE_MAGIC_LEN;
+    return 0;
+}
+
+
+
+static int hex_digit(char c)
+
+{
+
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+
+
+static int is_space(char c)
+
+{
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+
+
+static int read_varint(char** cur, char* end, unsigned long long* v)
+
+{
+
+    unsigned char* p = (unsigned char*)*cur;
+    int shift = 0;
+
+    *v = 0;
+    while (p < (unsigned char*)end && shift < 64)
+    {
+        *v |= (unsigned long long)(*p & 0x7f) << shift;
+        if (!(*p++ & 0x80))
+        {
+            *cur = (char*)p;
+            return 1;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+
+
+static int next_binary_record(trace* t, char* op, unsigned long long* address, int* size)
+
+{
+
+    char* p = t->cur;
+    unsigned long long v;
+
+    if (p >= t->end)
+        return 0;
+
+    int h = (unsigned char)*p++;
+    int code = h & 0x3f;
+
+    if (code == TRACE_SIZE_NEW)
+    {
+        if (!read_varint(&p, t->end, &v))
+            return 0;
+        *size = (int)v;
+        if (t->size_count < TRACE_SIZE_NEW)
+            t->sizes[t->size_count++] = *size;
+    }
+    else if (code < t->size_count)
+        *size = t->sizes[code];
+    else
+        return 0; // corrupt
+
+    if (!read_varint(&p, t->end, &v))
+        return 0;
+    t->prev_address += (v >> 1) ^ -(v & 1);
+
+    *op = "LSMI"[h >> 6];
+    *address = t->prev_address;
+    t->cur = p;
+    return 1;
+}
+
+
+
+// same grammar as fscanf(" %c %llx,%d"), returns 0 at end of trace
+int next_record(trace* t, char* op, unsigned long long* address, int* size)
+
+{
+
+    if (t->binary)
+        return next_binary_record(t, op, address, size);
+
+    char* p = t->cur;
+    char* end = t->end;
+
+    while (p < end && is_space(*p))
+        p++;
+    if (p == end)
+    {
+        t->cur = p;
+        return 0;
+    }
+
+    *op = *p++;
+    t->thread = 0;
+
+    while (p < end && is_space(*p))
+        p++;
+
+    unsigned long long a = 0;
+    int d;
+
+    if (p + 1 < end && p[0] == '0' && (p[1] | 0x20) == 'x')
+        p += 2;
+    while (p < end && (d = hex_digit(*p)) >= 0)
+    {
+        a = (a << 4) | d;
+        p++;
+    }
+    *address = a;
+
+    if (p < end && *p == ',')
+
+    {
+        int n = 0;
+        int neg = 0;
+
+        p++;
+        while (p < end && is_space(*p))
+            p++;
+        if (p < end && (*p == '-' || *p == '+'))
+            neg = *p++ == '-';
+        while (p < end && *p >= '0' && *p <= '9')
+            n = n * 10 + (*p++ - '0');
+        *size = neg ? -n : n;
+
+        if (p < end && *p == ',')
+        {
+            int tid = 0;
+            for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+                tid = tid * 10 + (*p - '0');
+            t->thread = tid;
+        }
+    }
+
+    // skip anything else left on the line
+    while (p < end && *p != '\n')
+        p++;
+
+    t->cur = p;
+    return 1;
+}
+
+
+
+void rewind_trace(trace* t)
+
+{
+
+    t->cur = t->data + (t->binary ? TRACE_MAGIC_LEN : 0);
+    t->prev_address = 0;
+    t->size_count = 0;
+}
+
+
+
+void close_trace(trace* t)
+
+{
+
+    if (t->mapped)
+        munmap(t->data, t->length);
+    else
+        free(t->data);
+    t->data = t->cur = t->end = 0;
+}
+
+
+
+// printSummary takes ints; past INT_MAX print the same line ourselves
+void print_summary(unsigned long long hit, unsigned long long miss, unsigned long long eviction)
+
+{
+
+    if (hit <= INT_MAX && miss <= INT_MAX && eviction <= INT_MAX)
+        printSummary(hit, miss, eviction);
+    else
+        printf("hits:%llu misses:%llu evictions:%llu\n", hit, miss, eviction);
+}
+
+
+
+double now_sec(void)
+
+{
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+
+// -r: seconds for one decode-only pass over the trace, which is rewound
+double time_parse(trace* file)
+
+{
+
+    char op;
+    unsigned long long address;
+    int size;
+    volatile unsigned long long sink = 0; // keeps the loop from being dropped
+
+    double start = now_sec();
+    while (next_record(file, &op, &address, &size))
+        sink += address;
+    double elapsed = now_sec() - start;
+
+    (void)sink;
+    rewind_trace(file);
+    return elapsed;
+}
+
+
+// ---- -c three-C miss classification ----
+//
+// A miss is compulsory on the first touch of its block, capacity if a
+// fully associative LRU cache of the same size (the shadow) misses too,
+// and conflict otherwise. The shadow is a block_map (which also records
+// every block ever seen) plus an intrusive recency list, MRU at head.
+
+int init_three_c(three_c* c, Cache* cache)
+
+{
+
+    size_t n = (size_t)1 << cache->s;
+
+    c->capacity = (size_t)cache->E << cache->s;
+    c->count = 0;
+    c->head = c->tail = -1;
+    c->prev = malloc(c->capacity * sizeof(long));
+    c->next = malloc(c->capacity * sizeof(long));
+    c->block = malloc(c->capacity * sizeof(unsigned long long));
+    c->per_set = calloc(n * 3, sizeof(unsigned long long));
+    c->compulsory = c->capacity_misses = c->conflict = 0;
+
+    return !c->prev || !c->next || !c->block || !c->per_set || map_init(&c->seen);
+}
+
+
+
+void free_three_c(three_c* c)
+
+{
+
+    free(c->prev);
+    free(c->next);
+    free(c->block);
+    free(c->per_set);
+    free(c->seen.entries);
+}
+
+
+
+static void unlink_node(three_c* c, long i)
+
+{
+
+    if (c->prev[i] >= 0)
+        c->next[c->prev[i]] = c->next[i];
+    else
+        c->head = c->next[i];
+    if (c->next[i] >= 0)
+        c->prev[c->next[i]] = c->prev[i];
+    else
+        c->tail = c->prev[i];
+}
+
+
+
+static void push_front(three_c* c, long i)
+
+{
+
+    c->prev[i] = -1;
+    c->next[i] = c->head;
+    if (c->head >= 0)
+        c->prev[c->head] = i;
+    c->head = i;
+    if (c->tail < 0)
+        c->tail = i;
+}
+
+
+
+// reference the shadow cache; returns 1 on a shadow hit, -1 on the first
+// touch of the block, 0 otherwise (or if out of memory)
+static int shadow_access(three_c* c, unsigned long long block)
+
+{
+
+    block_entry* e = map_find(&c->seen, block);
+    int first = !e->used;
+    long node;
+
+    if (!first && e->value) // value is node + 1 while resident
+    {
+        node = e->value - 1;
+        unlink_node(c, node);
+        push_front(c, node);
+        return 1;
+    }
+
+    if (first && !(e = map_insert(&c->seen, block)))
+        return 0;
+
+    if (c->count < c->capacity)
+        node = c->count++;
+    else
+    {
+        node = c->tail;
+        unlink_node(c, node);
+        map_find(&c->seen, c->block[node])->value = 0;
+    }
+
+    c->block[node] = block;
+    e->value = node + 1;
+    push_front(c, node);
+    return first ? -1 : 0;
+}
+
+
+
+// access both caches and charge a main-cache miss to one of the three Cs
+static void classify_access(three_c* c, Cache* cache, int verbose, unsigned long long address,
+                            int store, unsigned long long* hit, unsigned long long* miss,
+                            unsigned long long* eviction)
+
+{
+
+    int r = update(cache, verbose, address, store, hit, miss, eviction);
+    int shadow = shadow_access(c, address >> cache->b);
+    unsigned long long* counts = &c->per_set[3 * set_index_of(cache, address)];
+
+    if (r == RESULT_HIT)
+        return;
+
+    if (shadow < 0)
+    {
+        c->compulsory++;
+        counts[0]++;
+    }
+    else if (!shadow)
+    {
+        c->capacity_misses++;
+        counts[1]++;
+    }
+    else
+    {
+        c->conflict++;
+        counts[2]++;
+    }
+}
+
+
+
+void simulate_three_c(three_c* c, Cache* cache, trace* file, int verbose, unsigned long long* hit,
+                      unsigned long long* miss, unsigned long long* eviction,
+                      unsigned long long* accesses)
+
+{
+
+    char op;
+    unsigned long long address;
+    int size = 0;
+
+    while (next_record(file, &op, &address, &size))
+
+    {
+        int store = size > 0 ? size : 1;
+
+        if (op != 'L' && op != 'S' && op != 'M')
+            continue;
+
+        if (cache->tlb)
+            tlb_access(cache->tlb, address);
+        if (verbose)
+            event_begin(verbose, op, address, size);
+        if (op == 'M')
+            classify_access(c, cache, verbose, address, 0, hit, miss, eviction);
+        classify_access(c, cache, verbose, address, op == 'L' ? 0 : store, hit, miss, eviction);
+        if (verbose)
+            event_end(verbose);
+        (*accesses)++;
+    }
+}
+
+
+
+void print_three_c(three_c* c, Cache* cache)
+
+{
+
+    printf("compulsory:%llu capacity:%llu conflict:%llu\n",
+           c->compulsory, c->capacity_misses, c->conflict);
+
+    for (int i = 0; i < (1 << cache->s); i++)
+    {
+        unsigned long long* counts = &c->per_set[3 * i];
+        if (counts[0] || counts[1] || counts[2])
+            printf("set %d compulsory:%llu capacity:%llu conflict:%llu\n",
+                   i, counts[0], counts[1], counts[2]);
+    }
+}
+
+
+
+// ---- -k / -K sampled simulation ----
+//
+// -k r simulates only the sets whose hashed index is 0 mod r; records for
+// the other sets return right after decode in update_policy. -K w,p[,u]
+// splits the trace into periods of p records: u warm-up records update
+// the cache uncounted, the next w are measured, the rest are skipped.
+// Totals are estimated as population * mean over units, with a 95%
+// confidence interval from the spread between units.
+
+// <window>,<period>[,<warmup>]
+int parse_sampling(const char* spec, sampler* sp)
+
+{
+
+    sp->warmup = 0;
+    int n = sscanf(spec, "%llu,%llu,%llu", &sp->window, &sp->period, &sp->warmup);
+
+    return n < 2 || !sp->window || sp->period < sp->window + sp->warmup;
+}
+
+
+
+static unsigned long long mix64(unsigned long long x)
+
+{
+
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+
+
+int init_sampler(sampler* sp, Cache* cache)
+
+{
+
+    size_t n = (size_t)1 << cache->s;
+    int ratio = sp->set_ratio ? sp->set_ratio : 1;
+
+    cache->sampled = calloc(n, 1);
+    sp->per_set = calloc(3 * n, sizeof(unsigned long long));
+    if (!cache->sampled || !sp->per_set)
+        return 1;
+
+    // hashing keeps a strided pattern of sets from lining up with the sample
+    for (size_t i = 0; i < n; i++)
+        if (mix64(i) % ratio == 0)
+        {
+            cache->sampled[i] = 1;
+            sp->sets++;
+        }
+
+    if (!sp->sets)
+    {
+        cache->sampled[0] = 1;
+        sp->sets = 1;
+    }
+    return 0;
+}
+
+
+
+static void add_unit(sampler* sp, unsigned long long* counts)
+
+{
+
+    for (int k = 0; k < 3; k++)
+    {
+        sp->sum[k] += counts[k];
+        sp->square[k] += (double)counts[k] * counts[k];
+    }
+    sp->units++;
+}
+
+
+
+// counts = 0 charges the access to its set
+static void sampled_access(sampler* sp, Cache* cache, unsigned long long address, int store,
+                           unsigned long long* counts)
+
+{
+
+    unsigned long long* c = counts ? counts : &sp->per_set[3 * set_index_of(cache, address)];
+
+    update(cache, 0, address, store, &c[0], &c[1], &c[2]);
+}
+
+
+
+void simulate_sampled(sampler* sp, Cache* cache, trace* file, unsigned long long* accesses)
+
+{
+
+    char op;
+    unsigned long long address;
+    int size = 0;
+    unsigned long long records = 0;
+    unsigned long long window[3] = {};
+    unsigned long long warm[3] = {};
+
+    while (next_record(file, &op, &address, &size))
+
+    {
+        if (op != 'L' && op != 'S' && op != 'M')
+            continue;
+
+        int store = size > 0 ? size : 1;
+        unsigned long long* counts = 0;
+        unsigned long long r = 0; // position in the period
+
+        if (sp->window)
+        {
+            r = records++ % sp->period;
+            if (r >= sp->warmup + sp->window)
+                continue;
+            counts = r < sp->warmup ? warm : window;
+        }
+
+        if (op == 'M')
+            sampled_access(sp, cache, address, 0, counts);
+        sampled_access(sp, cache, address, op == 'L' ? 0 : store, counts);
+        (*accesses)++;
+
+        if (counts == window && r == sp->warmup + sp->window - 1)
+        {
+            add_unit(sp, window);
+            window[0] = window[1] = window[2] = 0;
+        }
+    }
+
+    if (sp->window)
+    {
+        sp->population = (double)records / sp->window; // a cut-off last window is dropped
+        return;
+    }
+
+    for (size_t i = 0; i < (size_t)1 << cache->s; i++)
+        if (cache->sampled[i])
+            add_unit(sp, &sp->per_set[3 * i]);
+    sp->population = (double)(1ULL << cache->s);
+}
+
+
+
+void print_sampled(sampler* sp, Cache* cache)
+
+{
+
+    double n = sp->units;
+    double N = sp->population;
+    // under -K every window only saw the sampled sets
+    double scale = sp->window ? (double)(1ULL << cache->s) / sp->sets : 1.0;
+    double fpc = N > n ? 1 - n / N : 0;
+    double estimate[3];
+    double half[3];
+
+    for (int k = 0; k < 3; k++)
+    {
+        double mean = n ? sp->sum[k] / n : 0;
+        double var = n > 1 ? (sp->square[k] - n * mean * mean) / (n - 1) : 0;
+        estimate[k] = scale * N * mean;
+        half[k] = scale * 1.96 * N * sqrt((var > 0 ? var : 0) / (n ? n : 1) * fpc);
+    }
+
+    print_summary(llround(estimate[0]), llround(estimate[1]), llround(estimate[2]));
+    printf("sampled %llu of %.0f %s, 95%% CI hits:+-%.0f misses:+-%.0f evictions:+-%.0f\n",
+           sp->units, N, sp->window ? "windows" : "sets", half[0], half[1], half[2]);
+
+    free(sp->per_set);
+    sp->per_set = 0;
+}
+
+
+
+// ---- -R run-length coalescing ----
+//
+// A pre-pass over the trace merges consecutive accesses to one block into
+// a reference: the first access goes through update(), the repeats are
+// credited as hits in bulk. The block was just accessed, so each repeat
+// would hit, and every policy's touch is idempotent (LRU keeps only the
+// last stamp), so the counts are exact. Under no-write-allocate a store
+// may leave the block uncached, so a store never starts a run there.
+
+static int coalescer_next(coalescer* co)
+
+{
+
+    while (next_record(co->file, &co->op, &co->address, &co->size))
+        if (co->op == 'L' || co->op == 'S' || co->op == 'M')
+            return co->pending = 1;
+    return co->pending = 0;
+}
+
+
+
+// returns 0 at the end of the trace
+int next_reference(coalescer* co, reference* r)
+
+{
+
+    if (!co->pending && !coalescer_next(co))
+        return 0;
+
+    int store = co->size > 0 ? co->size : 1;
+    unsigned long long block = co->address >> co->b;
+
+    r->address = co->address;
+    r->store = co->op == 'S' ? store : 0;
+    r->repeats = co->op == 'M';
+    r->stores = co->op == 'M';
+    r->store_bytes = co->op == 'M' ? store : 0;
+    r->records = 1;
+
+    if (co->no_write_allocate && r->store)
+    {
+        coalescer_next(co);
+        return 1;
+    }
+
+    while (coalescer_next(co) && co->address >> co->b == block)
+    {
+        int n = co->op == 'M' ? 2 : 1;
+        store = co->size > 0 ? co->size : 1;
+        r->repeats += n;
+        if (co->op != 'L')
+        {
+            r->stores++;
+            r->store_bytes += store;
+        }
+        r->records++;
+    }
+    return 1;
+}
+
+
+
+// apply a reference's repeats to its (now cached) block
+static void credit_repeats(Cache* cache, reference* r, unsigned long long* hit)
+
+{
+
+    set* cache_set = &cache->sets[set_index_of(cache, r->address)];
+    int way = find_tag(cache_set, cache->ways, r->address >> (cache->b + cache->s));
+
+    *hit += r->repeats;
+    cache->clock += r->repeats;
+    policy_touch(cache, cache_set, way, cache->clock, cache->policy);
+
+    if (r->stores && cache->write_through)
+        cache->bytes_written += r->store_bytes;
+    else if (r->stores)
+        write_way(cache, cache_set, way, 1);
+}
+
+
+
+void simulate_coalesced(Cache* cache, trace* file, unsigned long long* hit,
+                        unsigned long long* miss, unsigned long long* eviction,
+                        unsigned long long* accesses, unsigned long long* references)
+
+{
+
+    coalescer co = { .file = file, .b = cache->b, .no_write_allocate = cache->no_write_allocate };
+    reference r;
+
+    while (next_reference(&co, &r))
+    {
+        update(cache, 0, r.address, r.store, hit, miss, eviction);
+        if (r.repeats)
+            credit_repeats(cache, &r, hit);
+        *accesses += r.records;
+        (*references)++;
+    }
+}
+
+
+
+// ---- block hash map: block address -> 64-bit value, open addressing ----
+
+int map_init(block_map* m)
+
+{
+
+    m->size = 1 << 12;
+    m->used = 0;
+    m->entries = calloc(m->size, sizeof(block_entry));
+    return !m->entries;
+}
+
+
+
+// slot holding block, or the empty slot where it would go
+block_entry* map_find(block_map* m, unsigned long long block)
+
+{
+
+    size_t mask = m->size - 1;
+    size_t i = (block * 0x9E3779B97F4A7C15ULL) >> 17 & mask;
+
+    while (m->entries[i].used && m->entries[i].block != block)
+        i = (i + 1) & mask;
+    return &m->entries[i];
+}
+
+
+
+// find or add block, growing the table at half load; 0 if out of memory
+block_entry* map_insert(block_map* m, unsigned long long block)
+
+{
+
+    block_entry* e = map_find(m, block);
+
+    if (e->used)
+        return e;
+
+    if (2 * (m->used + 1) > m->size)
+    {
+        block_entry* old = m->entries;
+        size_t old_size = m->size;
+
+        m->entries = calloc(m->size * 2, sizeof(block_entry));
+        if (!m->entries)
+        {
+            m->entries = old;
+            return 0;
+        }
+        m->size *= 2;
+        for (size_t i = 0; i < old_size; i++)
+        {
+            if (old[i].used)
+                *map_find(m, old[i].block) = old[i];
+        }
+        free(old);
+        e = map_find(m, block);
+    }
+
+    e->used = 1;
+    e->block = block;
+    e->value = 0;
+    m->used++;
+    return e;
+}
+
+
+
+// ---- single-pass sweep: per-set LRU stack distances (Mattson) ----
+//
+// For each (s, b) a block's stack distance is the number of distinct blocks
+// of its set touched since its previous access. An E-way LRU cache hits
+// exactly when that distance is < E, so one pass gives every E at once.
+// Distances are counted with a Fenwick tree over each set's access
+// positions in which only the latest position of every block is marked.
+
+#define MAX_SWEEP 32 // per -s / -b list
+#define LOG_BUCKETS 64
+
+typedef struct
+{
+    int* tree;                  // Fenwick tree over positions [0, cap)
+    unsigned long long* owner;  // block accessed at each position
+    unsigned cap;
+    unsigned now;               // next free position
+    unsigned live;              // distinct blocks seen in this set
+} stack_set;
+
+
+
+typedef struct
+{
+    int s;
+    int b;
+    stack_set* sets;
+    block_map last;             // block -> position of its last access
+    unsigned long long* reuse;  // reuse[d] for d < E_max
+    unsigned long long* cold;   // cold[min(live, E_max)] for first touches
+    unsigned long long far[LOG_BUCKETS]; // d in [E_max * 2^k, E_max * 2^(k+1))
+    unsigned long long accesses;
+} sweep_config;
+
+
+
+// number of marked positions in [0, i)
+static unsigned fenwick_sum(int* tree, unsigned i)
+
+{
+
+    unsigned sum = 0;
+    for (; i > 0; i -= i & -i)
+        sum += tree[i - 1];
+    return sum;
+}
+
+
+
+static void fenwick_add(int* tree, unsigned cap, unsigned i, int delta)
+
+{
+
+    for (i++; i <= cap; i += i & -i)
+        tree[i - 1] += delta;
+}
+
+
+
+// renumber the live positions of a set into a fresh, larger tree
+static int compact_set(sweep_config* c, stack_set* st)
+
+{
+
+    unsigned cap = 2 * (st->live + 1);
+    if (cap < 64)
+        cap = 64;
+
+    int* tree = calloc(cap, sizeof(int));
+    unsigned long long* owner = malloc(cap * sizeof(unsigned long long));
+    unsigned n = 0;
+
+    if (!tree || !owner)
+    {
+        free(tree);
+        free(owner);
+        return 1;
+    }
+
+    for (unsigned i = 0; i < st->now; i++)
+    {
+        block_entry* e = map_find(&c->last, st->owner[i]);
+        if (e->value == i) // still the latest access of that block
+        {
+            e->value = n;
+            owner[n] = st->owner[i];
+            tree[n++] = 1;
+        }
+    }
+
+    // linear-time Fenwick build
+    for (unsigned i = 1; i <= cap; i++)
+    {
+        unsigned j = i + (i & -i);
+        if (j <= cap)
+            tree[j - 1] += tree[i - 1];
+    }
+
+    free(st->tree);
+    free(st->owner);
+    st->tree = tree;
+    st->owner = owner;
+    st->cap = cap;
+    st->now = n;
+    return 0;
+}
+
+
+
+static int sweep_access(sweep_config* c, int E_max, unsigned long long address)
+
+{
+
+    unsigned long long block = address >> c->b;
+    stack_set* st = &c->sets[block & ((1ULL << c->s) - 1)];
+
+    if (st->now == st->cap && compact_set(c, st))
+        return 1;
+
+    block_entry* e = map_find(&c->last, block);
+
+    c->accesses++;
+
+    if (e->used)
+
+    {
+        unsigned d = fenwick_sum(st->tree, st->now) - fenwick_sum(st->tree, e->value + 1);
+
+        fenwick_add(st->tree, st->cap, e->value, -1);
+        if (d < (unsigned)E_max)
+            c->reuse[d]++;
+        else
+        {
+            int k = 0;
+            while ((unsigned long long)E_max << (k + 1) <= d)
+                k++;
+            c->far[k]++;
+        }
+    }
+
+    else
+
+    {
+        c->cold[st->live < (unsigned)E_max ? st->live : (unsigned)E_max]++;
+        st->live++;
+
+        if (!(e = map_insert(&c->last, block)))
+            return 1;
+    }
+
+    e->value = st->now;
+    st->owner[st->now] = block;
+    fenwick_add(st->tree, st->cap, st->now, 1);
+    st->now++;
+    return 0;
+}
+
+
+
+static int parse_list(const char* list, int* values)
+
+{
+
+    int n = 0;
+    char* end;
+
+    while (*list && n < MAX_SWEEP)
+    {
+        values[n] = strtol(list, &end, 10);
+        if (end == list || values[n] < 0)
+            return 0;
+        n++;
+        list = *end == ',' ? end + 1 : end;
+    }
+    return n;
+}
+
+
+
+static void print_sweep(sweep_config* c, int E_max)
+
+{
+
+    unsigned long long hits = 0;
+    unsigned long long far_reuse = c->accesses;
+    unsigned long long cold_total = 0;
+
+    for (int d = 0; d <= E_max; d++)
+        cold_total += c->cold[d];
+    far_reuse -= cold_total;
+
+    unsigned long long cold_full = cold_total; // cold misses with live >= E
+
+    for (int E = 1; E <= E_max; E++)
+    {
+        hits += c->reuse[E - 1];
+        far_reuse -= c->reuse[E - 1];
+        cold_full -= c->cold[E - 1];
+        printf("s=%d E=%d b=%d hits:%llu misses:%llu evictions:%llu\n", c->s, E, c->b,
+               hits, c->accesses - hits, far_reuse + cold_full);
+    }
+
+    printf("reuse distance s=%d b=%d:\n", c->s, c->b);
+    for (int d = 0; d < E_max; d++)
+    {
+        if (c->reuse[d])
+            printf("  %d %llu\n", d, c->reuse[d]);
+    }
+    for (int k = 0; k < LOG_BUCKETS; k++)
+    {
+        if (c->far[k])
+            printf("  [%llu,%llu) %llu\n", (unsigned long long)E_max << k,
+                   (unsigned long long)E_max << (k + 1), c->far[k]);
+    }
+    printf("  cold %llu\n", cold_total);
+}
+
+
+
+int sweep(trace* file, const char* s_list, int E_max, const char* b_list)
+
+{
+
+    int s_values[MAX_SWEEP];
+    int b_values[MAX_SWEEP];
+    int ns = parse_list(s_list, s_values);
+    int nb = parse_list(b_list, b_values);
+    int n = ns * nb;
+    int failed = 0;
+
+    if (!ns || !nb)
+        return 1;
+
+    sweep_config* configs = calloc(n, sizeof(sweep_config));
+    if (!configs)
+        return 1;
+
+    for (int i = 0; i < n && !failed; i++)
+    {
+        sweep_config* c = &configs[i];
+
+        c->s = s_values[i / nb];
+        c->b = b_values[i % nb];
+        if (c->s > 30 || c->b > 62)
+        {
+            failed = 1;
+            break;
+        }
+        c->sets = calloc((size_t)1 << c->s, sizeof(stack_set));
+        c->reuse = calloc(E_max, sizeof(unsigned long long));
+        c->cold = calloc(E_max + 1, sizeof(unsigned long long));
+        failed = !c->sets || !c->reuse || !c->cold || map_init(&c->last);
+    }
+
+    char op;
+    unsigned long long address;
+    int size;
+
+    while (!failed && next_record(file, &op, &address, &size))
+
+    {
+        int count = op == 'M' ? 2 : (op == 'L' || op == 'S');
+
+        for (int k = 0; k < count; k++)
+        {
+            for (int i = 0; i < n && !failed; i++)
+                failed = sweep_access(&configs[i], E_max, address);
+        }
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        sweep_config* c = &configs[i];
+
+        if (!failed)
+            print_sweep(c, E_max);
+
+        for (size_t j = 0; c->sets && j < ((size_t)1 << c->s); j++)
+        {
+            free(c->sets[j].tree);
+            free(c->sets[j].owner);
+        }
+        free(c->sets);
+        free(c->last.entries);
+        free(c->reuse);
+        free(c->cold);
+    }
+
+    free(configs);
+    return failed;
+}
+
+
+
+// ---- -L multi-level hierarchy ----
+
+// <s>,<E>,<b>[,inclusive|exclusive|nine[,<latency>]]
+int parse_level(const char* spec, level* lv)
+
+{
+
+    char policy[16] = "nine";
+
+    lv->latency = 1;
+    int n = sscanf(spec, "%d,%d,%d,%15[a-z],%d", &lv->cache.s, &lv->cache.E, &lv->cache.b,
+                   policy, &lv->latency);
+
+    if (n < 3 || lv->cache.s < 0 || lv->cache.E < 1 || lv->cache.b < 0 || lv->latency < 0)
+        return 1;
+
+    if (!strcmp(policy, "inclusive"))
+        lv->policy = INCLUSIVE;
+    else if (!strcmp(policy, "exclusive"))
+        lv->policy = EXCLUSIVE;
+    else if (!strcmp(policy, "nine"))
+        lv->policy = NINE;
+    else
+        return 1;
+    return 0;
+}
+
+
+
+// look the block up and drop it if present; returns 1 if it was there,
+// with *dirty set if it held data not yet written back
+static int take_block(Cache* cache, unsigned long long address, int* dirty)
+
+{
+
+    int set_index = set_index_of(cache, address);
+    unsigned long long tag = address >> (cache->b + cache->s);
+    set* cache_set = &cache->sets[set_index];
+    int way = find_tag(cache_set, cache->ways, tag);
+
+    *dirty = 0;
+    if (way < 0)
+        return 0;
+    *dirty = (cache_set->dirty[way >> 6] >> (way & 63)) & 1;
+    cache_set->valid[way >> 6] &= ~(1ULL << (way & 63));
+    cache_set->dirty[way >> 6] &= ~(1ULL << (way & 63));
+    return 1;
+}
+
+
+
+// a write of the whole block at `address`, if it is cached; returns 1 if so
+static int mark_dirty(Cache* cache, unsigned long long address)
+
+{
+
+    set* cache_set = &cache->sets[set_index_of(cache, address)];
+    int way = find_tag(cache_set, cache->ways, address >> (cache->b + cache->s));
+
+    if (way < 0)
+        return 0;
+    write_way(cache, cache_set, way, 1 << cache->b);
+    return 1;
+}
+
+
+
+// put a block coming down from the level above into `cache` without
+// fetching it: an exclusive level's spill or a write-back, dirty if
+// `dirty`. Returns RESULT_HIT if the block was already there, otherwise
+// RESULT_MISS or RESULT_EVICTION with the victim as update() leaves it
+static int insert_block(Cache* cache, unsigned long long address, int dirty,
+                        unsigned long long* eviction)
+
+{
+
+    int set_index = set_index_of(cache, address);
+    unsigned long long tag = address >> (cache->b + cache->s);
+    set* cache_set = &cache->sets[set_index];
+    unsigned long long bytes_read = cache->bytes_read;
+    unsigned long long unused = 0;
+    int result = RESULT_MISS;
+
+    if (find_tag(cache_set, cache->ways, tag) >= 0)
+    {
+        if (dirty)
+            mark_dirty(cache, address);
+        return RESULT_HIT;
+    }
+
+    unsigned long long now = ++cache->clock;
+    if (!check_miss(cache, cache_set, tag, 0, &unused, now, cache->policy))
+    {
+        check_eviction(cache, cache_set, set_index, tag, 0, eviction, now, cache->policy);
+        result = RESULT_EVICTION;
+    }
+    cache->bytes_read = bytes_read; // the data came from above
+    if (dirty)
+        mark_dirty(cache, address);
+    return result;
+}
+
+
+
+// keep inclusion: a block leaving level i must leave every level above.
+// Dirty copies there are written back; returns 1 if there were any
+static int back_invalidate(level* levels, int i, unsigned long long address)
+
+{
+
+    unsigned long long block = 1ULL << levels[i].cache.b;
+    int written = 0;
+
+    address &= ~(block - 1);
+    for (int j = 0; j < i; j++)
+    {
+        Cache* cache = &levels[j].cache;
+        unsigned long long step = 1ULL << cache->b;
+        int dirty;
+
+        for (unsigned long long a = address; a - address < block; a += step)
+        {
+            if (!take_block(cache, a, &dirty))
+                continue;
+            levels[i].back_invalidations++;
+            if (dirty)
+            {
+                cache->dirty_evictions++;
+                cache->bytes_written += step;
+                written = 1;
+            }
+        }
+    }
+    return written;
+}
+
+
+
+// whether the block level i just evicted leaves it dirty; an inclusive
+// level first takes it out of the levels above, and a dirty copy there
+// makes it a write-back from level i too
+static int victim_dirty(level* levels, int i)
+
+{
+
+    Cache* cache = &levels[i].cache;
+
+    if (levels[i].policy == INCLUSIVE && back_invalidate(levels, i, cache->victim_address)
+        && !cache->victim_dirty)
+    {
+        cache->dirty_evictions++;
+        cache->bytes_written += 1ULL << cache->b;
+        return 1;
+    }
+    return cache->victim_dirty;
+}
+
+
+
+// blocks evicted from level i - 1 move into level i: always into an
+// exclusive level, and as a write-back into the others when dirty (a
+// clean copy is just dropped). Whatever that pushes out goes to `out`
+static void drain(level* levels, int i, const victim_list* in, victim_list* out)
+
+{
+
+    for (int k = 0; k < in->n; k++)
+    {
+        Cache* cache = &levels[i].cache;
+
+        if (!in->dirty[k] && levels[i].policy != EXCLUSIVE)
+            continue;
+        if (insert_block(cache, in->address[k], in->dirty[k], &levels[i].eviction)
+            == RESULT_EVICTION)
+        {
+            out->address[out->n] = cache->victim_address;
+            out->dirty[out->n++] = victim_dirty(levels, i);
+        }
+    }
+}
+
+
+
+// send one reference down the hierarchy until some level hits; returns
+// the access latency in cycles. Victims reach the next level before its
+// lookup, like a write-back buffer draining, except in an exclusive level:
+// there the block found leaves first and the victim takes its place
+static int hierarchy_access(level* levels, int n, int memory_latency, unsigned long long address,
+                            int store)
+
+{
+
+    victim_list in = { .n = 0 };
+    victim_list out;
+    int found = 0;
+    int cycles = 0;
+
+    for (int i = 0; i < n; i++)
+
+    {
+        level* lv = &levels[i];
+
+        out.n = 0;
+
+        if (i > 0 && lv->policy == EXCLUSIVE)
+        {
+            // exclusive levels are filled only by victims from above; a
+            // dirty block moves up to the nearest level that took the fill
+            // when that one holds all of it, else it is written back
+            int was_dirty;
+            if (!found)
+            {
+                cycles += lv->latency;
+                if (take_block(&lv->cache, address, &was_dirty))
+                {
+                    int j = i - 1;
+                    while (j > 0 && levels[j].policy == EXCLUSIVE)
+                        j--;
+                    if (was_dirty && !(levels[j].cache.b == lv->cache.b
+                                       && mark_dirty(&levels[j].cache, address)))
+                    {
+                        lv->cache.dirty_evictions++;
+                        lv->cache.bytes_written += 1ULL << lv->cache.b;
+                    }
+                    lv->hit++;
+                    found = 1;
+                }
+                else
+                    lv->miss++;
+            }
+            drain(levels, i, &in, &out);
+        }
+
+        else
+
+        {
+            drain(levels, i, &in, &out);
+            if (!found)
+            {
+                cycles += lv->latency;
+
+                // only L1 sees the store itself, lower levels are asked for the block
+                int r = update(&lv->cache, 0, address, i ? 0 : store, &lv->hit, &lv->miss,
+                               &lv->eviction);
+                if (r == RESULT_EVICTION)
+                {
+                    out.address[out.n] = lv->cache.victim_address;
+                    out.dirty[out.n++] = victim_dirty(levels, i);
+                }
+                found = r == RESULT_HIT;
+            }
+        }
+
+        in = out;
+    }
+
+    if (!found)
+        cycles += memory_latency;
+    return cycles;
+}
+
+
+
+int simulate_hierarchy(trace* file, level* levels, int n, int memory_latency)
+
+{
+
+    int failed = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        if (init_cache(&levels[i].cache))
+            failed = 1;
+    }
+
+    char op;
+    unsigned long long address;
+    int size;
+    unsigned long long accesses = 0;
+    unsigned long long cycles = 0;
+
+    while (!failed && next_record(file, &op, &address, &size))
+
+    {
+        int count = op == 'M' ? 2 : (op == 'L' || op == 'S');
+
+        for (int k = 0; k < count; k++)
+        {
+            int store = op == 'L' || k < count - 1 ? 0 : (size > 0 ? size : 1);
+            cycles += hierarchy_access(levels, n, memory_latency, address, store);
+            accesses++;
+        }
+    }
+
+    for (int i = 0; i < n && !failed; i++)
+    {
+        level* lv = &levels[i];
+        static const char* names[] = { "inclusive", "exclusive", "nine" };
+
+        printf("L%d (s=%d E=%d b=%d %s) hits:%llu misses:%llu evictions:%llu"
+               " back-invalidations:%llu"
+               " dirty-evictions:%llu bytes-read:%llu bytes-written:%llu\n",
+               i + 1, lv->cache.s, lv->cache.E, lv->cache.b, names[lv->policy],
+               lv->hit, lv->miss, lv->eviction, lv->back_invalidations,
+               lv->cache.dirty_evictions, lv->cache.bytes_read, lv->cache.bytes_written);
+    }
+    if (!failed)
+        printf("AMAT: %.2f cycles\n", accesses ? (double)cycles / accesses : 0.0);
+
+    for (int i = 0; i < n; i++)
+        free_cache(&levels[i].cache);
+    return failed;
+}
+
+
+
+// ---- -T TLB and page walks ----
+//
+// The DTLB and STLB are Caches whose block size is the page size, so a
+// "block" is a translation. An STLB miss walks the x86-64 page table
+// (4 levels for 4KB pages, 3 for 2MB, 2 for 1GB). The page-walk caches
+// are small fully associative Caches keyed on the address prefix of the
+// upper-level entries (PML4E, PDPTE, PDE); a walk starts below the
+// deepest one that hits and fills all of them.
+
+static const int walk_shift[3] = { 39, 30, 21 }; // prefix covered by a PML4E, PDPTE, PDE
+static const int walk_entries[3] = { 2, 4, 32 };
+
+// <4k|2m|1g>,<s>,<E>[,<stlb s>,<stlb E>]
+int parse_tlb(const char* spec, tlb* t)
+
+{
+
+    char page[4];
+    int n = sscanf(spec, "%3[a-z0-9],%d,%d,%d,%d", page, &t->l1.s, &t->l1.E, &t->l2.s,
+                   &t->l2.E);
+
+    if (n != 3 && n != 5)
+        return 1;
+    if (!strcmp(page, "4k"))
+        t->page_shift = 12;
+    else if (!strcmp(page, "2m"))
+        t->page_shift = 21;
+    else if (!strcmp(page, "1g"))
+        t->page_shift = 30;
+    else
+        return 1;
+    t->levels = t->page_shift == 12 ? 4 : t->page_shift == 21 ? 3 : 2;
+
+    return t->l1.s < 0 || t->l1.E < 1 || (n == 5 && (t->l2.s < 0 || t->l2.E < 1));
+}
+
+
+
+int init_tlb(tlb* t)
+
+{
+
+    t->l1.b = t->l2.b = t->page_shift;
+    if (init_cache(&t->l1) || (t->l2.E && init_cache(&t->l2)))
+        return 1;
+
+    for (int k = 0; k < t->levels - 1; k++)
+    {
+        t->walk[k].E = walk_entries[k];
+        t->walk[k].b = walk_shift[k];
+        if (init_cache(&t->walk[k]))
+            return 1;
+    }
+    return 0;
+}
+
+
+
+void free_tlb(tlb* t)
+
+{
+
+    free_cache(&t->l1);
+    free_cache(&t->l2);
+    for (int k = 0; k < 3; k++)
+        free_cache(&t->walk[k]);
+}
+
+
+
+// translate one access; the simulate loops call it once per trace record
+void tlb_access(tlb* t, unsigned long long address)
+
+{
+
+    unsigned long long eviction = 0;
+
+    if (update(&t->l1, 0, address, 0, &t->l1_hit, &t->l1_miss, &eviction) == RESULT_HIT)
+        return;
+    if (t->l2.E && update(&t->l2, 0, address, 0, &t->l2_hit, &t->l2_miss, &eviction) == RESULT_HIT)
+        return;
+
+    int deepest = -1;
+    for (int k = 0; k < t->levels - 1; k++)
+        if (update(&t->walk[k], 0, address, 0, &t->walk_hit[k], &t->walk_miss[k], &eviction)
+            == RESULT_HIT)
+            deepest = k;
+
+    t->walks++;
+    t->walk_references += t->levels - 1 - deepest;
+}
+
+
+
+void print_tlb(tlb* t)
+
+{
+
+    printf("dtlb-hits:%llu dtlb-misses:%llu", t->l1_hit, t->l1_miss);
+    if (t->l2.E)
+        printf(" stlb-hits:%llu stlb-misses:%llu", t->l2_hit, t->l2_miss);
+    printf(" walks:%llu walk-references:%llu", t->walks, t->walk_references);
+
+    static const char* names[] = { "pml4e", "pdpte", "pde" };
+    for (int k = 0; k < t->levels - 1; k++)
+        printf(" %s-hits:%llu", names[k], t->walk_hit[k]);
+    printf("\n");
+}
+
+
+
+// ---- -C MESI / MOESI coherence ----
+//
+// Each thread (tid mod n) runs on its own private cache; the caches snoop
+// one bus. A load miss is a BusRd: other copies become S, or O for a
+// dirty copy under MOESI (under MESI it is written back and becomes S).
+// A store miss is a BusRdX and a store hit on a shared copy a BusUpgr;
+// both invalidate every other copy. A miss on a block this core lost to
+// an invalidation is a coherence miss, and a false-sharing one when it
+// touches none of the bytes the other cores wrote since.
+
+// <n>[,mesi|moesi]
+int parse_coherence(const char* spec, coherence* co)
+
+{
+
+    char protocol[8] = "mesi";
+    int n = sscanf(spec, "%d,%7[a-z]", &co->n, protocol);
+
+    if (n < 1 || co->n < 1 || co->n > MAX_CORES)
+        return 1;
+    if (!strcmp(protocol, "moesi"))
+        co->moesi = 1;
+    else if (strcmp(protocol, "mesi"))
+        return 1;
+    return 0;
+}
+
+
+
+int init_coherence(coherence* co, int s, int E, int b)
+
+{
+
+    if (map_init(&co->lines))
+        return 1;
+
+    for (int i = 0; i < co->n; i++)
+    {
+        Cache* cache = &co->cores[i].cache;
+        cache->s = s;
+        cache->E = E;
+        cache->b = b;
+        if (init_cache(cache))
+            return 1;
+        co->cores[i].shared = calloc((size_t)cache->valid_words << s, sizeof(unsigned long long));
+        if (!co->cores[i].shared)
+            return 1;
+    }
+    return 0;
+}
+
+
+
+void free_coherence(coherence* co)
+
+{
+
+    for (int i = 0; i < co->n; i++)
+    {
+        free_cache(&co->cores[i].cache);
+        free(co->cores[i].shared);
+    }
+    free(co->lines.entries);
+    free(co->records);
+}
+
+
+
+// the word of core->shared holding `way` of `address`' set, or 0 if not cached
+static unsigned long long* shared_word(core* c, unsigned long long address, int* way)
+
+{
+
+    Cache* cache = &c->cache;
+    int set_index = set_index_of(cache, address);
+
+    *way = find_tag(&cache->sets[set_index], cache->ways, address >> (cache->b + cache->s));
+    if (*way < 0)
+        return 0;
+    return &c->shared[(size_t)set_index * cache->valid_words + (*way >> 6)];
+}
+
+
+
+static line_record* line_of(coherence* co, unsigned long long block)
+
+{
+
+    block_entry* e = map_find(&co->lines, block);
+
+    if (e->used)
+        return &co->records[e->value];
+
+    if (co->record_count == co->record_cap)
+    {
+        size_t cap = co->record_cap ? 2 * co->record_cap : 1024;
+        line_record* grown = realloc(co->records, cap * sizeof(line_record));
+        if (!grown)
+            return 0;
+        co->records = grown;
+        co->record_cap = cap;
+    }
+    if (!(e = map_insert(&co->lines, block)))
+        return 0;
+
+    e->value = co->record_count;
+    line_record* line = &co->records[co->record_count++];
+    memset(line, 0, sizeof(line_record));
+    line->block = block;
+    return line;
+}
+
+
+
+// bytes of the block an access touches, one bit per byte (per 2^(b-6)
+// bytes for blocks over 64)
+static unsigned long long byte_mask(int b, unsigned long long address, int size)
+
+{
+
+    int g = b > 6 ? b - 6 : 0;
+    int first = (address & ((1ULL << b) - 1)) >> g;
+    int last = ((address & ((1ULL << b) - 1)) + (size > 0 ? size : 1) - 1) >> g;
+
+    if (last > 63)
+        last = 63;
+    return (last == 63 ? ~0ULL : (1ULL << (last + 1)) - 1) & ~((1ULL << first) - 1);
+}
+
+
+
+enum { BUS_RDX, BUS_UPGR }; // the transactions that invalidate other copies
+
+
+
+// drop every other core's copy for a write by core `c`; returns 1 on failure.
+// A BusRdX fetches the block, so a dirty copy elsewhere is flushed to it. A
+// BusUpgr comes from a core that already holds the data in S: other copies
+// are S too, or O under MOESI, whose dirty data the writer takes over, so
+// nothing is flushed.
+static int invalidate_others(coherence* co, int c, unsigned long long address,
+                             unsigned long long bytes, int transaction)
+
+{
+
+    for (int i = 0; i < co->n; i++)
+    {
+        core* other = &co->cores[i];
+        Cache* cache = &other->cache;
+        int way;
+        int dirty;
+
+        if (i == c || !shared_word(other, address, &way))
+            continue;
+
+        set* cache_set = &cache->sets[set_index_of(cache, address)];
+        if (transaction == BUS_RDX && ((cache_set->dirty[way >> 6] >> (way & 63)) & 1))
+        {
+            other->flushes++;
+            if (!co->moesi) // MOESI hands the dirty data over without a memory write
+                cache->bytes_written += 1ULL << cache->b;
+        }
+        take_block(cache, address, &dirty);
+
+        line_record* line = line_of(co, address >> cache->b);
+        if (!line)
+            return 1;
+        other->invalidations++;
+        line->invalidations++;
+        line->lost |= 1u << i;
+        line->written[i] = bytes;
+    }
+    return 0;
+}
+
+
+
+// one load (store = 0) or store of `size` bytes by core `c`
+static int coherent_access(coherence* co, int c, unsigned long long address, int size,
+                           int store)
+
+{
+
+    core* me = &co->cores[c];
+    Cache* cache = &me->cache;
+    unsigned long long block = address >> cache->b;
+    unsigned long long bytes = byte_mask(cache->b, address, size);
+    int way;
+
+    int r = update(cache, 0, address, store ? size : 0, &me->hit, &me->miss, &me->eviction);
+    unsigned long long* mine = shared_word(me, address, &way);
+    unsigned long long bit = 1ULL << (way & 63);
+
+    if (r != RESULT_HIT)
+
+    {
+        block_entry* e = map_find(&co->lines, block);
+        line_record* line = e->used ? &co->records[e->value] : 0;
+
+        if (line && (line->lost >> c) & 1)
+        {
+            int false_sharing = !(bytes & line->written[c]);
+            me->coherence_misses++;
+            line->coherence_misses++;
+            me->false_sharing += false_sharing;
+            line->false_sharing += false_sharing;
+            line->lost &= ~(1u << c);
+        }
+
+        if (store)
+        {
+            co->bus_read_exclusive++;
+            if (invalidate_others(co, c, address, bytes, BUS_RDX))
+                return 1;
+            *mine &= ~bit;
+        }
+        else
+        {
+            int others = 0;
+            co->bus_reads++;
+            for (int i = 0; i < co->n; i++)
+            {
+                core* other = &co->cores[i];
+                unsigned long long* word;
+                int w;
+
+                if (i == c || !(word = shared_word(other, address, &w)))
+                    continue;
+                others = 1;
+                *word |= 1ULL << (w & 63);
+
+                set* cache_set = &other->cache.sets[set_index_of(&other->cache, address)];
+                if ((cache_set->dirty[w >> 6] >> (w & 63)) & 1)
+                {
+                    other->flushes++;
+                    if (!co->moesi) // M -> S writes back, M -> O keeps the dirty copy
+                    {
+                        cache_set->dirty[w >> 6] &= ~(1ULL << (w & 63));
+                        other->cache.bytes_written += 1ULL << cache->b;
+                    }
+                }
+            }
+            *mine = others ? *mine | bit : *mine & ~bit;
+        }
+    }
+
+    else if (store && (*mine & bit))
+
+    {
+        co->bus_upgrades++;
+        if (invalidate_others(co, c, address, bytes, BUS_UPGR))
+            return 1;
+        *mine &= ~bit;
+    }
+
+    if (store)
+    {
+        block_entry* e = map_find(&co->lines, block);
+        line_record* line = e->used ? &co->records[e->value] : 0;
+
+        for (int i = 0; line && i < co->n; i++)
+            if ((line->lost >> i) & 1)
+                line->written[i] |= bytes;
+    }
+    return 0;
+}
+
+
+
+static int by_false_sharing(const void* a, const void* b)
+
+{
+
+    const line_record* x = a;
+    const line_record* y = b;
+
+    if (x->false_sharing != y->false_sharing)
+        return x->false_sharing < y->false_sharing ? 1 : -1;
+    if (x->coherence_misses != y->coherence_misses)
+        return x->coherence_misses < y->coherence_misses ? 1 : -1;
+    return x->block < y->block ? -1 : x->block > y->block;
+}
+
+
+
+#define HOTSPOTS 10
+
+int simulate_coherence(trace* file, coherence* co, unsigned long long* accesses)
+
+{
+
+    char op;
+    unsigned long long address;
+    int size = 0;
+    unsigned long long hit = 0;
+    unsigned long long miss = 0;
+    unsigned long long eviction = 0;
+
+    while (next_record(file, &op, &address, &size))
+
+    {
+        int c = file->thread % co->n;
+        int failed = 0;
+
+        switch (op)
+        {
+        case 'L':
+        case 'S':
+            failed = coherent_access(co, c, address, size, op == 'S');
+            break;
+        case 'M':
+            failed = coherent_access(co, c, address, size, 0)
+                  || coherent_access(co, c, address, size, 1);
+            break;
+        default:
+            continue;
+        }
+        if (failed)
+            return 1;
+        (*accesses)++;
+    }
+
+    for (int i = 0; i < co->n; i++)
+    {
+        hit += co->cores[i].hit;
+        miss += co->cores[i].miss;
+        eviction += co->cores[i].eviction;
+    }
+    print_summary(hit, miss, eviction);
+
+    for (int i = 0; i < co->n; i++)
+    {
+        core* c = &co->cores[i];
+        printf("cache %d hits:%llu misses:%llu evictions:%llu invalidations:%llu"
+               " coherence-misses:%llu false-sharing:%llu flushes:%llu bytes-written:%llu\n",
+               i, c->hit, c->miss, c->eviction, c->invalidations, c->coherence_misses,
+               c->false_sharing, c->flushes, c->cache.bytes_written);
+    }
+    printf("bus-reads:%llu bus-read-exclusive:%llu bus-upgrades:%llu\n",
+           co->bus_reads, co->bus_read_exclusive, co->bus_upgrades);
+
+    // lines that ping-pong the most, false sharing first
+    qsort(co->records, co->record_count, sizeof(line_record), by_false_sharing);
+    for (size_t i = 0; i < co->record_count && i < HOTSPOTS; i++)
+    {
+        line_record* line = &co->records[i];
+        int b = co->cores[0].cache.b;
+        printf("line %llx invalidations:%llu coherence-misses:%llu false-sharing:%llu\n",
+               line->block << b, line->invalidations, line->coherence_misses,
+               line->false_sharing);
+    }
+    return 0;
+}
+
+
+
+// ---- library API (csim.h) ----
+
+struct csim
+{
+    Cache cache;
+    unsigned long long hit;
+    unsigned long long miss;
+    unsigned long long eviction;
+};
+
+
+
+csim* csim_create(int s, int E, int b)
+
+{
+
+    if (s < 0 || E < 1 || b < 0)
+        return 0;
+
+    csim* c = calloc(1, sizeof(csim));
+    if (!c)
+        return 0;
+
+    c->cache.s = s;
+    c->cache.E = E;
+    c->cache.b = b;
+    select_tag_kernel();
+    if (init_cache(&c->cache))
+    {
+        free(c);
+        return 0;
+    }
+    return c;
+}
+
+
+
+void csim_access(csim* c, unsigned long long address, int store)
+
+{
+    update(&c->cache, 0, address, store, &c->hit, &c->miss, &c->eviction);
+}
+
+
+
+void csim_counts(csim* c, unsigned long long* hit, unsigned long long* miss,
+                 unsigned long long* eviction)
+
+{
+
+    *hit = c->hit;
+    *miss = c->miss;
+    *eviction = c->eviction;
+}
+
+
+
+void csim_destroy(csim* c)
+
+{
+
+    if (!c)
+        return;
+    free_cache(&c->cache);
+    free(c);
+}
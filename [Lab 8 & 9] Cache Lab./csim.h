@@ -0,0 +1,69 @@
+/* 20210741 김소현 */
+/* sooohyun@postech.ac.kr*/
+
+/*
+ * csim.h - definitions shared by csim and its helper tools
+ *
+ * Binary trace format (written by csim-pack, read natively by csim):
+ *
+ *   "CSIMBIN1"                          8-byte magic
+ *   per record:
+ *     1 byte   op << 6 | size_code
+ *     varint   zigzag(address - previous address)
+ *
+ * op is one of TRACE_OP_*. size_code indexes a size dictionary that both
+ * sides build in record order: TRACE_SIZE_NEW means the size follows as
+ * a varint (before the address) and is appended to the dictionary while
+ * it has fewer than TRACE_SIZE_NEW entries. Varints are little-endian
+ * base-128, 7 bits per byte, high bit set on all but the last byte.
+ * Thread ids ("L addr,size,tid") are not kept, so csim -C refuses binary
+ * traces.
+ */
+
+#ifndef CSIM_H
+#define CSIM_H
+
+#define TRACE_MAGIC "CSIMBIN1"
+#define TRACE_MAGIC_LEN 8
+
+#define TRACE_OP_L 0
+#define TRACE_OP_S 1
+#define TRACE_OP_M 2
+#define TRACE_OP_I 3
+
+#define TRACE_SIZE_NEW 63
+
+
+
+/*
+ * Event log (csim -e <file>): EVENT_MAGIC, then one csim_event per cache
+ * access in trace order, in native byte order. Both accesses of an M
+ * record share its index. result is 0 hit, 1 miss, 2 eviction.
+ */
+#define EVENT_MAGIC "CSIMEVT1"
+#define EVENT_MAGIC_LEN 8
+
+typedef struct
+{
+    unsigned long long index; // L/S/M record number, from 0
+    unsigned set;
+    unsigned result;
+} csim_event;
+
+
+
+/*
+ * Embeddable simulator. Build csim.c with -DCSIM_LIB to leave out main()
+ * and link it into a program that produces its own addresses, like the
+ * tracing build of trans.c (see trans-trace.c). A handle is one LRU,
+ * write-back, write-allocate cache.
+ */
+typedef struct csim csim;
+
+csim* csim_create(int s, int E, int b); // 0 on a bad geometry or out of memory
+void csim_access(csim* c, unsigned long long address, int store); // store = bytes written
+void csim_counts(csim* c, unsigned long long* hit, unsigned long long* miss,
+                 unsigned long long* eviction);
+void csim_destroy(csim* c);
+
+#endif
@@ -0,0 +1,193 @@
+/* 20210741 김소현 */
+/* sooohyun@postech.ac.kr*/
+
+/*
+ * trans-bench - thread scaling of trans_parallel, and regular against
+ *     non-temporal stores, measured against memcpy
+ *
+ *   gcc -g -Wall -Werror -std=c99 -m64 -O0 -pthread -DTRANS_THREADS \
+ *       -o trans-bench trans-bench.c trans.c cachelab.c
+ *   ./trans-bench [-M <cols>] [-N <rows>] [-p <max threads>] [-r <repeats>]
+ *                 [-m <stream min bytes>]
+ *
+ * Built at -O0 like the driver; the SIMD kernels in trans.c are
+ * optimized on their own. Every figure is the best of -r runs as GB/s,
+ * counting each element read once and written once, next to a
+ * single-threaded memcpy of the same bytes: first trans_oblivious
+ * (regular stores) against trans_streaming (non-temporal stores) on one
+ * thread, then trans_parallel on 1..-p threads (default: online CPUs)
+ * with its automatic choice between the two, which is printed above its
+ * table (-m sets trans_stream_min; -1 never streams).
+ *
+ * The thread table has only been run on a one-CPU host so far, where
+ * more threads can only cost time; trans_parallel's multi-core scaling
+ * is unmeasured.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+int is_transpose(int M, int N, int A[N][M], int B[M][N]);
+void trans_parallel(int M, int N, int A[N][M], int B[M][N]);
+void trans_oblivious(int M, int N, int A[N][M], int B[M][N]);
+void trans_streaming(int M, int N, int A[N][M], int B[M][N]);
+
+long long trans_stream_threshold(void);
+int trans_streams(int M, int N, int B[M][N]);
+
+extern int trans_threads;
+extern long long trans_stream_min;
+
+
+
+static double now_sec(void)
+
+{
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+
+// best of `repeats` runs of `func`, in seconds; -1 if B comes out wrong
+static double best_time(void (*func)(int M, int N, int[N][M], int[M][N]), int M, int N,
+                        int* A, int* B, int repeats)
+
+{
+
+    double best = 0;
+
+    for (int k = 0; k < repeats; k++)
+    {
+        double start = now_sec();
+        func(M, N, (int (*)[M])A, (int (*)[N])B);
+        double elapsed = now_sec() - start;
+        if (!k || elapsed < best)
+            best = elapsed;
+    }
+    return is_transpose(M, N, (int (*)[M])A, (int (*)[N])B) ? best : -1;
+}
+
+
+
+int main(int argc, char* argv[])
+
+{
+
+    int M = 8192;
+    int N = 8192;
+    int max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int repeats = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "M:N:p:r:m:h")) != -1)
+    {
+
+        switch (opt)
+        {
+        case 'M':
+            M = atoi(optarg);
+            break;
+        case 'N':
+            N = atoi(optarg);
+            break;
+        case 'p':
+            max_threads = atoi(optarg);
+            break;
+        case 'r':
+            repeats = atoi(optarg);
+            break;
+        case 'm':
+            trans_stream_min = atoll(optarg);
+            break;
+        case 'h':
+            printf("Usage: ./trans-bench [-M <cols>] [-N <rows>] [-p <max threads>]"
+                   " [-r <repeats>] [-m <stream min bytes>]\n");
+            return 0;
+        default:
+            return 1;
+        }
+
+    }
+
+    if (M < 1 || N < 1 || max_threads < 1 || repeats < 1)
+        return 1;
+
+    size_t bytes = (size_t)M * N * sizeof(int);
+    int* A;
+    int* B;
+
+    if (posix_memalign((void**)&A, 64, bytes) || posix_memalign((void**)&B, 64, bytes))
+        return 1;
+    for (size_t i = 0; i < (size_t)M * N; i++)
+        A[i] = (int)i;
+    memset(B, 0, bytes); // fault B in before timing
+
+    double copy = 0;
+    for (int k = 0; k < repeats; k++)
+    {
+        double start = now_sec();
+        memcpy(B, A, bytes);
+        double elapsed = now_sec() - start;
+        if (!k || elapsed < copy)
+            copy = elapsed;
+    }
+    double copy_rate = 2.0 * bytes / copy / 1e9;
+
+    printf("%dx%d, %.1f MB per matrix\n", M, N, bytes / 1048576.0);
+    printf("%-10s %9s %8s %9s %8s\n", "stores", "time", "GB/s", "speedup", "memcpy");
+    printf("%-10s %8.2fms %8.2f %9s %7.0f%%\n", "memcpy", copy * 1e3, copy_rate, "-", 100.0);
+
+    double regular = best_time(trans_oblivious, M, N, A, B, repeats);
+    double streaming = best_time(trans_streaming, M, N, A, B, repeats);
+    if (regular < 0 || streaming < 0)
+    {
+        fprintf(stderr, "wrong result from the %s transpose\n",
+                regular < 0 ? "regular" : "streaming");
+        return 1;
+    }
+    printf("%-10s %8.2fms %8.2f %9s %7.0f%%\n", "regular", regular * 1e3,
+           2.0 * bytes / regular / 1e9, "-", 100 * 2.0 * bytes / regular / 1e9 / copy_rate);
+    printf("%-10s %8.2fms %8.2f %8.2fx %7.0f%%\n", "streaming", streaming * 1e3,
+           2.0 * bytes / streaming / 1e9, regular / streaming,
+           100 * 2.0 * bytes / streaming / 1e9 / copy_rate);
+
+    long long threshold = trans_stream_threshold();
+    printf("\nauto: %s stores (B %.1f MB, ", trans_streams(M, N, (int (*)[N])B)
+           ? "streaming" : "regular", bytes / 1048576.0);
+    if (threshold < 0)
+        printf("streaming off)\n");
+    else
+        printf("threshold %.1f MB)\n", threshold / 1048576.0);
+
+    printf("%-10s %9s %8s %9s %8s\n", "threads", "time", "GB/s", "speedup", "memcpy");
+
+    double single = 0;
+    for (int t = 1; t <= max_threads; t++)
+    {
+        trans_threads = t;
+        double best = best_time(trans_parallel, M, N, A, B, repeats);
+        if (best < 0)
+        {
+            fprintf(stderr, "wrong result on %d threads\n", t);
+            return 1;
+        }
+        if (t == 1)
+            single = best;
+
+        double rate = 2.0 * bytes / best / 1e9;
+        printf("%-10d %8.2fms %8.2f %8.2fx %7.0f%%\n", t, best * 1e3, rate, single / best,
+               100 * rate / copy_rate);
+    }
+
+    free(A);
+    free(B);
+    return 0;
+}
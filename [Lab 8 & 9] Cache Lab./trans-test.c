@@ -0,0 +1,148 @@
+/* 20210741 김소현 */
+/* sooohyun@postech.ac.kr*/
+
+/*
+ * trans-test - run every registered transpose function on odd shapes and
+ *     check the result with is_transpose
+ *
+ *   gcc -g -Wall -Werror -std=c99 -m64 -O0 -pthread -DTRANS_THREADS \
+ *       -o trans-test trans-test.c trans.c cachelab.c
+ *   ./trans-test [-v]
+ *
+ * Each function runs on every shape twice, once with B on a 64-byte line
+ * and once one int past it, so the SIMD kernels, the streaming path and
+ * the in-place variants all see both. trans_parallel runs on 4 threads
+ * whatever the CPU count, so its bands are split even on one CPU. The
+ * whole set runs twice, since trans.c picks its kernels once per process:
+ * in a child with TRANS_SCALAR=1, then here with the SIMD kernels. A must
+ * come back unchanged and B must be its transpose. -v lists every run,
+ * not just the failures. Exits 1 if any run fails.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "cachelab.h"
+
+#define MAX_ELEMENTS (1024 * 1024)
+
+
+
+extern trans_func_t func_list[MAX_TRANS_FUNCS];
+extern int func_counter;
+extern int trans_threads;
+
+void registerFunctions();
+int is_transpose(int M, int N, int A[N][M], int B[M][N]);
+
+// M columns by N rows, as the driver's -M / -N
+static const int shapes[][2] = {
+    { 1, 1 },     { 7, 9 },    { 9, 7 },    { 32, 32 },    { 64, 64 },
+    { 61, 67 },   { 67, 61 },  { 4096, 33 }, { 33, 4096 }, { 1024, 1024 },
+};
+
+#define SHAPE_COUNT (int)(sizeof(shapes) / sizeof(shapes[0]))
+
+
+
+// run every function on every shape and B offset; returns the failures
+static int run_all(const char* mode, int* a, int* b, int verbose)
+
+{
+
+    int runs = 0;
+    int failures = 0;
+
+    for (int i = 0; i < func_counter; i++)
+        for (int k = 0; k < SHAPE_COUNT; k++)
+            for (int offset = 0; offset < 2; offset++)
+            {
+                int M = shapes[k][0];
+                int N = shapes[k][1];
+                int* B = b + offset;
+                int ok;
+
+                for (int j = 0; j < M * N; j++)
+                {
+                    a[j] = j;
+                    B[j] = -1;
+                }
+
+                (*func_list[i].func_ptr)(M, N, (int (*)[M])a, (int (*)[N])B);
+
+                ok = is_transpose(M, N, (int (*)[M])a, (int (*)[N])B);
+                for (int j = 0; ok && j < M * N; j++)
+                    ok = a[j] == j;
+
+                runs++;
+                failures += !ok;
+                if (!ok || verbose)
+                    printf("%-4s %s %dx%d B%s (%s)\n", ok ? "ok" : "FAIL", mode, M, N,
+                           offset ? "+4" : "", func_list[i].description);
+            }
+
+    printf("%s: %d runs, %d failed\n", mode, runs, failures);
+    return failures;
+}
+
+
+
+int main(int argc, char* argv[])
+
+{
+
+    int verbose = 0;
+    int failures = 0;
+    int opt;
+    int* a;
+    int* b;
+
+    while ((opt = getopt(argc, argv, "vh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'v':
+            verbose = 1;
+            break;
+        case 'h':
+            printf("Usage: ./trans-test [-v]\n");
+            return 0;
+        default:
+            return 1;
+        }
+    }
+
+    if (posix_memalign((void**)&a, 64, MAX_ELEMENTS * sizeof(int))
+        || posix_memalign((void**)&b, 64, (MAX_ELEMENTS + 16) * sizeof(int)))
+        return 1;
+
+    registerFunctions();
+    trans_threads = 4;
+
+    fflush(stdout);
+    pid_t pid = fork();
+    int status;
+
+    if (pid < 0)
+        return 1;
+    if (!pid)
+    {
+        setenv("TRANS_SCALAR", "1", 1);
+        int failed = run_all("scalar", a, b, verbose) != 0;
+        fflush(stdout);
+        _exit(failed);
+    }
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+        failures++;
+
+    unsetenv("TRANS_SCALAR");
+    failures += run_all("simd", a, b, verbose);
+
+    free(a);
+    free(b);
+    return failures != 0;
+}
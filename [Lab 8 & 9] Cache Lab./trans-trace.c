@@ -0,0 +1,144 @@
+/* 20210741 김소현 */
+/* sooohyun@postech.ac.kr*/
+
+/*
+ * trans-trace - count the cache behaviour of the registered transpose
+ *     functions in-process, through the csim library, instead of a
+ *     valgrind trace + csim round trip
+ *
+ *   gcc -g -Wall -Werror -std=c99 -m64 -O0 -pthread -DTRANS_TRACE -DCSIM_LIB \
+ *       -o trans-trace trans-trace.c trans.c csim.c cachelab.c -lm
+ *   ./trans-trace [-M <cols>] [-N <rows>] [-F <function>] [-s <s>] [-E <E>] [-b <b>]
+ *
+ * The defaults are the graded setup: 32x32 on a 1KB direct-mapped cache
+ * with 32-byte blocks (s=5 E=1 b=5). Only the matrix accesses are
+ * counted, scalar and vector; the valgrind trace also holds the
+ * function's stack traffic, so the grader's numbers can be slightly
+ * higher. TRANS_SCALAR=1 traces the scalar paths instead of the SIMD
+ * kernels.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "cachelab.h"
+#include "csim.h"
+
+#define MAX_DIM 256
+
+
+
+extern trans_func_t func_list[MAX_TRANS_FUNCS];
+extern int func_counter;
+
+void registerFunctions();
+int is_transpose(int M, int N, int A[N][M], int B[M][N]);
+
+csim* trans_cache; // read by LOAD / STORE in trans.c
+
+// laid out like tracegen's matrices, block aligned so runs are repeatable
+static int A[MAX_DIM][MAX_DIM] __attribute__((aligned(64)));
+static int B[MAX_DIM][MAX_DIM] __attribute__((aligned(64)));
+
+
+
+static double now_ms(void)
+
+{
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+
+
+// run func_list[i] once on a fresh cache and print its counts
+static int run(int i, int M, int N, int s, int E, int b)
+
+{
+
+    unsigned long long hit, miss, eviction;
+
+    initMatrix(M, N, A, B);
+    if (!(trans_cache = csim_create(s, E, b)))
+        return 1;
+
+    double start = now_ms();
+    (*func_list[i].func_ptr)(M, N, A, B);
+    double elapsed = now_ms() - start;
+
+    csim_counts(trans_cache, &hit, &miss, &eviction);
+    printf("func %d (%s): hits:%llu misses:%llu evictions:%llu correct:%d time:%.3fms\n",
+           i, func_list[i].description, hit, miss, eviction, is_transpose(M, N, A, B),
+           elapsed);
+
+    csim_destroy(trans_cache);
+    trans_cache = 0;
+    return 0;
+}
+
+
+
+int main(int argc, char* argv[])
+
+{
+
+    int M = 32;
+    int N = 32;
+    int only = -1;
+    int s = 5;
+    int E = 1;
+    int b = 5;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "M:N:F:s:E:b:h")) != -1)
+    {
+
+        switch (opt)
+        {
+        case 'M':
+            M = atoi(optarg);
+            break;
+        case 'N':
+            N = atoi(optarg);
+            break;
+        case 'F':
+            only = atoi(optarg);
+            break;
+        case 's':
+            s = atoi(optarg);
+            break;
+        case 'E':
+            E = atoi(optarg);
+            break;
+        case 'b':
+            b = atoi(optarg);
+            break;
+        case 'h':
+            printf("Usage: ./trans-trace [-M <cols>] [-N <rows>] [-F <function>]"
+                   " [-s <s>] [-E <E>] [-b <b>]\n");
+            return 0;
+        default:
+            return 1;
+        }
+
+    }
+
+    if (M < 1 || N < 1 || M > MAX_DIM || N > MAX_DIM)
+        return 1;
+
+    registerFunctions();
+
+    if (only >= func_counter)
+        return 1;
+
+    for (int i = 0; i < func_counter; i++)
+        if ((only < 0 || i == only) && run(i, M, N, s, E, b))
+            return 1;
+
+    return 0;
+}
@@ -0,0 +1,302 @@
+/* 20210741 김소현 */
+/* sooohyun@postech.ac.kr*/
+
+/*
+ * trans-tune - search trans_blocked's tile size, sub-blocking and
+ *     diagonal handling for one shape and cache geometry, and record the
+ *     winner in the tuning table that transpose_submit reads
+ *
+ *   gcc -g -Wall -Werror -std=c99 -m64 -O0 -pthread -DTRANS_TRACE -DCSIM_LIB \
+ *       -o trans-tune trans-tune.c trans.c csim.c cachelab.c -lm
+ *   ./trans-tune [-M <cols>] [-N <rows>] [-s <s>] [-E <E>] [-b <b>] [-r <repeats>]
+ *                [-o <table>] [-v]
+ *
+ * Each candidate is scored by its misses on the simulated cache, through
+ * the csim library as in trans-trace, then by its host wall time (best
+ * of -r untraced runs). The built-in transpose_submit path, with the
+ * table switched off, is scored the same way; the tracing build keeps
+ * the SIMD kernels, so that is the path the driver grades, and the
+ * candidates run their whole 8x8 tiles through them too. With -o the
+ * table file (trans-tune.h, compiled into trans.c) gets the winning
+ * candidate's row if it has fewer misses than the built-in path;
+ * otherwise any old row for the shape is dropped. Rows are keyed on the
+ * SIMD level too, since the kernels change the miss counts: run again
+ * with TRANS_SCALAR=1 to tune the scalar path. Rebuild trans.c to pick
+ * the change up.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "cachelab.h"
+#include "csim.h"
+
+#define MAX_DIM 512
+#define MAX_CANDIDATES 128
+#define MAX_ROWS 256
+
+enum { DIAG_NONE, DIAG_DEFER, DIAG_BUFFER };
+
+static const char* diag_names[] = { "none", "defer", "buffer" };
+static const int tiles[] = { 4, 8, 12, 16, 20, 24, 32, 48, 64 };
+static const int subs[] = { 2, 4, 8 };
+
+void transpose_submit(int M, int N, int A[N][M], int B[M][N]);
+void trans_blocked(int M, int N, int A[N][M], int B[M][N], int tile, int sub, int diag);
+int is_transpose(int M, int N, int A[N][M], int B[M][N]);
+int trans_simd_level(void);
+
+extern int trans_use_table;
+
+csim* trans_cache; // read by LOAD / STORE in trans.c; 0 while timing
+
+static int A[MAX_DIM][MAX_DIM] __attribute__((aligned(64)));
+static int B[MAX_DIM][MAX_DIM] __attribute__((aligned(64)));
+
+
+
+// one point of the search; tile 0 is the built-in transpose_submit
+typedef struct
+{
+    int tile;
+    int sub;
+    int diag;
+    unsigned long long miss;
+    double time; // ms
+    int correct;
+} candidate;
+
+
+
+static double now_ms(void)
+
+{
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+
+
+static void run(const candidate* c, int M, int N)
+
+{
+
+    if (c->tile)
+        trans_blocked(M, N, A, B, c->tile, c->sub, c->diag);
+    else
+        transpose_submit(M, N, A, B);
+}
+
+
+
+static int score(candidate* c, int M, int N, int s, int E, int b, int repeats)
+
+{
+
+    unsigned long long hit, eviction;
+
+    initMatrix(M, N, A, B);
+    if (!(trans_cache = csim_create(s, E, b)))
+        return 1;
+    run(c, M, N);
+    csim_counts(trans_cache, &hit, &c->miss, &eviction);
+    csim_destroy(trans_cache);
+    trans_cache = 0;
+    c->correct = is_transpose(M, N, A, B);
+
+    for (int k = 0; k < repeats; k++)
+    {
+        double start = now_ms();
+        run(c, M, N);
+        double elapsed = now_ms() - start;
+        if (!k || elapsed < c->time)
+            c->time = elapsed;
+    }
+    return 0;
+}
+
+
+
+// fewer misses first, host time breaks ties
+static int better(const candidate* x, const candidate* y)
+
+{
+
+    if (x->correct != y->correct)
+        return x->correct;
+    if (x->miss != y->miss)
+        return x->miss < y->miss;
+    return x->time < y->time;
+}
+
+
+
+static void print_candidate(const char* label, const candidate* c)
+
+{
+
+    if (c->tile)
+        printf("%-8s tile:%-3d sub:%-3d diag:%-6s", label, c->tile, c->sub, diag_names[c->diag]);
+    else
+        printf("%-8s %-30s", label, "transpose_submit (built-in)");
+    printf(" misses:%llu time:%.3fms%s\n", c->miss, c->time, c->correct ? "" : " WRONG");
+}
+
+
+
+// rewrite the table at `path`, keeping its comment lines and other rows;
+// `winner` 0 drops the row for this key (shape, cache and SIMD level)
+static int update_table(const char* path, const int key[6], const candidate* winner)
+
+{
+
+    char lines[MAX_ROWS][128];
+    int n = 0;
+    char line[128];
+    FILE* in = fopen(path, "r");
+
+    if (in)
+    {
+        while (fgets(line, sizeof(line), in) && n < MAX_ROWS)
+        {
+            int row[6];
+            if (sscanf(line, " { %d , %d , %d , %d , %d , %d ,", &row[0], &row[1], &row[2],
+                       &row[3], &row[4], &row[5]) == 6 && !memcmp(row, key, sizeof(row)))
+                continue;
+            strcpy(lines[n++], line);
+        }
+        fclose(in);
+    }
+
+    if (winner && n < MAX_ROWS)
+        snprintf(lines[n++], sizeof(lines[0]), "    { %d, %d, %d, %d, %d, %d, %d, %d, %d },\n",
+                 key[0], key[1], key[2], key[3], key[4], key[5], winner->tile, winner->sub,
+                 winner->diag);
+
+    FILE* out = fopen(path, "w");
+    if (!out)
+        return 1;
+    for (int i = 0; i < n; i++)
+        fputs(lines[i], out);
+    return fclose(out) != 0;
+}
+
+
+
+int main(int argc, char* argv[])
+
+{
+
+    int M = 32;
+    int N = 32;
+    int s = 5;
+    int E = 1;
+    int b = 5;
+    int repeats = 3;
+    const char* table = 0;
+    int verbose = 0;
+    candidate candidates[MAX_CANDIDATES];
+    int n = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "M:N:s:E:b:r:o:vh")) != -1)
+    {
+
+        switch (opt)
+        {
+        case 'M':
+            M = atoi(optarg);
+            break;
+        case 'N':
+            N = atoi(optarg);
+            break;
+        case 's':
+            s = atoi(optarg);
+            break;
+        case 'E':
+            E = atoi(optarg);
+            break;
+        case 'b':
+            b = atoi(optarg);
+            break;
+        case 'r':
+            repeats = atoi(optarg);
+            break;
+        case 'o':
+            table = optarg;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'h':
+            printf("Usage: ./trans-tune [-M <cols>] [-N <rows>] [-s <s>] [-E <E>] [-b <b>]"
+                   " [-r <repeats>] [-o <table>] [-v]\n");
+            return 0;
+        default:
+            return 1;
+        }
+
+    }
+
+    if (M < 1 || N < 1 || M > MAX_DIM || N > MAX_DIM || repeats < 1)
+        return 1;
+
+    // tile x sub x diag, skipping tiles much larger than the matrix
+    int sub_count = sizeof(subs) / sizeof(subs[0]);
+    for (int t = 0; t < (int)(sizeof(tiles) / sizeof(tiles[0])); t++)
+    {
+        if (tiles[t] > 2 * (M > N ? M : N))
+            break;
+        for (int u = 0; u <= sub_count; u++)
+        {
+            int sub = u < sub_count ? subs[u] : tiles[t]; // last: no sub-blocking
+            if (u < sub_count && sub >= tiles[t])
+                continue;
+            for (int d = DIAG_NONE; d <= DIAG_BUFFER; d++)
+            {
+                if (d == DIAG_BUFFER && sub != 8)
+                    continue;
+                candidates[n++] = (candidate){ .tile = tiles[t], .sub = sub, .diag = d };
+            }
+        }
+    }
+
+    candidate builtin = { 0 };
+    trans_use_table = 0;
+    if (score(&builtin, M, N, s, E, b, repeats))
+        return 1;
+
+    int best = -1;
+    for (int i = 0; i < n; i++)
+    {
+        if (score(&candidates[i], M, N, s, E, b, repeats))
+            return 1;
+        if (verbose)
+            print_candidate("", &candidates[i]);
+        if (best < 0 || better(&candidates[i], &candidates[best]))
+            best = i;
+    }
+
+    printf("%dx%d on s=%d E=%d b=%d, SIMD level %d, %d candidates\n", M, N, s, E, b,
+           trans_simd_level(), n);
+    print_candidate("built-in", &builtin);
+    print_candidate("best", &candidates[best]);
+
+    int wins = candidates[best].correct && candidates[best].miss < builtin.miss;
+    printf("%s\n", wins ? "the tuned tiling wins" : "the built-in path stays");
+
+    if (table)
+    {
+        int key[6] = { M, N, s, E, b, trans_simd_level() };
+        if (update_table(table, key, wins ? &candidates[best] : 0))
+            return 1;
+        printf("updated %s\n", table);
+    }
+    return 0;
+}
@@ -0,0 +1,8 @@
+/*
+ * trans-tune.h - tuning table rows, included into tune_table in trans.c
+ *     and rewritten by trans-tune (./trans-tune -o trans-tune.h ...)
+ *
+ *   { M, N, s, E, b, simd, tile, sub, diag },
+ */
+    { 61, 67, 5, 1, 5, 0, 24, 8, 2 },
+    { 61, 67, 5, 1, 5, 2, 64, 8, 0 },
@@ -10,11 +10,119 @@
  * A transpose function is evaluated by counting the number of misses
  * on a 1KB direct mapped cache with a block size of 32 bytes.
  */ 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include "cachelab.h"
 
 int is_transpose(int M, int N, int A[N][M], int B[M][N]);
 
+/*
+ * LOAD / STORE - every scalar matrix access in a transpose function goes
+ *     through these, and every vector one through TRACE_VEC (see the
+ *     SIMD kernels). Normally they are plain accesses, so the graded
+ *     trace is unchanged. Built with -DTRANS_TRACE (see trans-trace.c)
+ *     they also hand each address to the csim library, load before store,
+ *     unless trans_cache is 0 (trans-tune times the functions that way).
+ *     A vector access is one access of its full width, as valgrind
+ *     records it for the grader.
+ */
+#ifdef TRANS_TRACE
+#include <stdint.h>
+#include "csim.h"
+extern csim* trans_cache;
+#define TRACE_ADDR(X) ((unsigned long long)(uintptr_t)&(X))
+#define TRACE(X, S) (trans_cache ? csim_access(trans_cache, TRACE_ADDR(X), (S)) : (void)0)
+#define LOAD(X) (TRACE(X, 0), (X))
+#define STORE(X, V) do { int v_ = (V); TRACE(X, sizeof(X)); (X) = v_; } while (0)
+#define TRACE_VEC(P, BYTES, S) (trans_cache \
+    ? csim_access(trans_cache, (unsigned long long)(uintptr_t)(P), (S) ? (BYTES) : 0) : (void)0)
+#else
+#define LOAD(X) (X)
+#define STORE(X, V) ((X) = (V))
+#define TRACE_VEC(P, BYTES, S) ((void)0)
+#endif
+
+/*
+ * The SIMD kernels are built into -DTRANS_TRACE builds too, so the
+ * traced counts are those of the path that runs in production;
+ * TRANS_SCALAR=1 in the environment traces the scalar code instead.
+ * VLOAD* / VSTORE* / VSTREAM* are the kernels' matrix accesses.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include <stdint.h>
+#define HAVE_X86_SIMD 1
+/* the driver builds trans.c at -O0, which would spill every vector to
+   the stack between instructions; the kernels are optimized regardless */
+#define SIMD_KERNEL(isa) __attribute__((target(isa), optimize("O2")))
+#define VLOAD256(P) (TRACE_VEC(P, 32, 0), _mm256_loadu_si256((__m256i*)(P)))
+#define VLOAD128(P) (TRACE_VEC(P, 16, 0), _mm_loadu_si128((__m128i*)(P)))
+#define VSTORE256(P, V) do { TRACE_VEC(P, 32, 1); _mm256_storeu_si256((__m256i*)(P), (V)); } while (0)
+#define VSTORE128(P, V) do { TRACE_VEC(P, 16, 1); _mm_storeu_si128((__m128i*)(P), (V)); } while (0)
+#define VSTREAM256(P, V) do { TRACE_VEC(P, 32, 1); _mm256_stream_si256((__m256i*)(P), (V)); } while (0)
+#define VSTREAM128(P, V) do { TRACE_VEC(P, 16, 1); _mm_stream_si128((__m128i*)(P), (V)); } while (0)
+#define VSTREAM32(P, V) do { TRACE_VEC(P, 4, 1); _mm_stream_si32((P), (V)); } while (0)
+#endif
+
+/*
+ * trans_parallel only starts threads when built with -DTRANS_THREADS
+ * (and -pthread), as trans-bench is; the driver build stays thread-free
+ * and runs every band on the calling thread. The csim library behind
+ * -DTRANS_TRACE is not thread-safe, so tracing builds never thread.
+ */
+#if defined(TRANS_THREADS) && !defined(TRANS_TRACE)
+#include <pthread.h>
+#define HAVE_THREADS 1
+#endif
+
+/* Base case of the recursive transpose: 8 ints, one 32-byte block */
+#define TILE 8
+
+/*
+ * Tuning table - trans_blocked parameters that trans-tune found to beat
+ *     the built-in paths for a shape on a cache geometry, with the SIMD
+ *     level it ran at (the 8x8 kernel changes the miss counts, so a row
+ *     only applies at its own level). transpose_submit looks its shape
+ *     up for the graded cache, TUNE_S / TUNE_E / TUNE_B.
+ */
+#ifndef TUNE_S
+#define TUNE_S 5
+#define TUNE_E 1
+#define TUNE_B 5
+#endif
+
+enum { DIAG_NONE, DIAG_DEFER, DIAG_BUFFER };
+
+typedef struct {
+    int M, N, s, E, b;
+    int simd;   /* trans_simd_level() */
+    int tile;   /* tile edge */
+    int sub;    /* columns of A (rows of B) per pass over a tile */
+    int diag;   /* DIAG_* */
+} tune_entry;
+
+static const tune_entry tune_table[] = {
+#include "trans-tune.h"
+    { 0 }
+};
+
+int trans_use_table = 1; /* trans-tune clears this to score the built-in paths */
+
+const tune_entry* trans_tuned_for(int M, int N, int s, int E, int b);
+int trans_simd_level(void);
+void trans_blocked(int M, int N, int A[N][M], int B[M][N], int tile, int sub, int diag);
+
+int trans_block8(int M, int N, int A[N][M], int B[M][N], int i, int j);
+int trans_swap8(int n, int X[n][n], int i, int j);
+long long trans_stream_threshold(void);
+int trans_streams(int M, int N, int B[M][N]);
+int trans_stream(int M, int N, int A[N][M], int B[M][N], int c0, int c1, int force);
+void trans_tile(int M, int N, int A[N][M], int B[M][N], int r0, int r1, int c0, int c1);
+void trans_recursive(int M, int N, int A[N][M], int B[M][N], int r0, int r1, int c0, int c1);
+
 /* 
  * transpose_submit - This is the solution transpose function that you
  *     will be graded on for Part B of the assignment. Do not change
@@ -28,6 +136,12 @@ void transpose_submit(int M, int N, int A[N][M], int B[M][N])
     int i, j, k;
     int tmp;
     int s0, s1, s2, s3, s4, s5, s6, s7;
+    const tune_entry* tuned = trans_tuned_for(M, N, TUNE_S, TUNE_E, TUNE_B);
+
+    if (tuned) {
+        trans_blocked(M, N, A, B, tuned->tile, tuned->sub, tuned->diag);
+        return;
+    }
 
     if(M == 32 && N == 32) {
         for (s0 = 0; 
@@ -38,18 +152,20 @@ void transpose_submit(int M, int N, int A[N][M], int B[M][N])
                 s1 < M; 
                 s1 += 8) 
                 {
+                if (trans_block8(M, N, A, B, s0, s1))
+                    continue;
                 for (i = s0; i < s0 + 8; i++) 
                 {
                     for (j = s1; j < s1 + 8; j++) 
                     {
                         if (i != j)
                         {
-                           B[j][i] = A[i][j];
+                           STORE(B[j][i], LOAD(A[i][j]));
                         }
-                        else tmp = A[i][i];
+                        else tmp = LOAD(A[i][i]);
                     }
                     if (s1 == s0)
-                        B[i][i] = tmp;
+                        STORE(B[i][i], tmp);
                 }
             }
         }
@@ -59,56 +175,58 @@ void transpose_submit(int M, int N, int A[N][M], int B[M][N])
     {
         for (i = 0; i < 64; i += 8) {
             for (j = 0; j < 64; j += 8) {
+                if (trans_block8(M, N, A, B, i, j))
+                    continue;
 
                 for (k = i ; k < i+4 ; k ++)
                     {
-                        s0 = A[k][j];
-                        s1 = A[k][j+1];
-                        s2 = A[k][j+2];
-                        s3 = A[k][j+3];
-                        s4 = A[k][j+4];
-                        s5 = A[k][j+5];
-                        s6 = A[k][j+6];
-                        s7 = A[k][j+7];
-
-                        B[j][k] = s0;
-                        B[j+1][k] = s1;
-                        B[j+2][k] = s2;
-                        B[j+3][k] = s3;
-
-                        B[j][k+4] = s7;
-                        B[j+1][k+4] = s6;
-                        B[j+2][k+4] = s5;
-                        B[j+3][k+4] = s4;
+                        s0 = LOAD(A[k][j]);
+                        s1 = LOAD(A[k][j+1]);
+                        s2 = LOAD(A[k][j+2]);
+                        s3 = LOAD(A[k][j+3]);
+                        s4 = LOAD(A[k][j+4]);
+                        s5 = LOAD(A[k][j+5]);
+                        s6 = LOAD(A[k][j+6]);
+                        s7 = LOAD(A[k][j+7]);
+
+                        STORE(B[j][k], s0);
+                        STORE(B[j+1][k], s1);
+                        STORE(B[j+2][k], s2);
+                        STORE(B[j+3][k], s3);
+
+                        STORE(B[j][k+4], s7);
+                        STORE(B[j+1][k+4], s6);
+                        STORE(B[j+2][k+4], s5);
+                        STORE(B[j+3][k+4], s4);
                     }
 
 
                     for (k=0;k<4;k++)
                     {
-                        s0 = A[i+4][j+3-k];
-                        s1 = A[i+5][j+3-k];
-                        s2 = A[i+6][j+3-k];
-                        s3 = A[i+7][j+3-k];
-
-                        s4 = A[i+4][j+4+k];
-                        s5 = A[i+5][j+4+k];
-                        s6 = A[i+6][j+4+k];
-                        s7 = A[i+7][j+4+k];
-
-                        B[j+k+4][i] = B[j+3-k][i+4];
-                        B[j+k+4][i+1] = B[j+3-k][i+5];
-                        B[j+k+4][i+2] = B[j+3-k][i+6];
-                        B[j+k+4][i+3] = B[j+3-k][i+7];
-
-                        B[j+3-k][i+4] = s0;
-                        B[j+3-k][i+5] = s1;
-                        B[j+3-k][i+6] = s2;
-                        B[j+3-k][i+7] = s3;
-
-                        B[j+4+k][i+4] = s4;
-                        B[j+4+k][i+5] = s5;
-                        B[j+4+k][i+6] = s6;
-                        B[j+4+k][i+7] = s7;
+                        s0 = LOAD(A[i+4][j+3-k]);
+                        s1 = LOAD(A[i+5][j+3-k]);
+                        s2 = LOAD(A[i+6][j+3-k]);
+                        s3 = LOAD(A[i+7][j+3-k]);
+
+                        s4 = LOAD(A[i+4][j+4+k]);
+                        s5 = LOAD(A[i+5][j+4+k]);
+                        s6 = LOAD(A[i+6][j+4+k]);
+                        s7 = LOAD(A[i+7][j+4+k]);
+
+                        STORE(B[j+k+4][i], LOAD(B[j+3-k][i+4]));
+                        STORE(B[j+k+4][i+1], LOAD(B[j+3-k][i+5]));
+                        STORE(B[j+k+4][i+2], LOAD(B[j+3-k][i+6]));
+                        STORE(B[j+k+4][i+3], LOAD(B[j+3-k][i+7]));
+
+                        STORE(B[j+3-k][i+4], s0);
+                        STORE(B[j+3-k][i+5], s1);
+                        STORE(B[j+3-k][i+6], s2);
+                        STORE(B[j+3-k][i+7], s3);
+
+                        STORE(B[j+4+k][i+4], s4);
+                        STORE(B[j+4+k][i+5], s5);
+                        STORE(B[j+4+k][i+6], s6);
+                        STORE(B[j+4+k][i+7], s7);
                     }
             }
         }
@@ -125,24 +243,28 @@ void transpose_submit(int M, int N, int A[N][M], int B[M][N])
             for (s1 = 0; s1 < M; 
                 s1 += 16) 
                 {
+                if (s0 + 16 <= N && s1 + 16 <= M && trans_block8(M, N, A, B, s0, s1)) {
+                    trans_block8(M, N, A, B, s0, s1 + 8);
+                    trans_block8(M, N, A, B, s0 + 8, s1);
+                    trans_block8(M, N, A, B, s0 + 8, s1 + 8);
+                    continue;
+                }
                 for (i = s0; i < N && i < s0 + 16; i++) 
                 {
                     for (j = s1; j < M && j < s1 + 16; j++) 
                     {
                         if (i != j)
-                           B[j][i] = A[i][j];
-                        else tmp = A[i][i];
+                           STORE(B[j][i], LOAD(A[i][j]));
+                        else tmp = LOAD(A[i][i]);
                     }
                     if (s1== s0)
-                        B[i][i] = tmp;
+                        STORE(B[i][i], tmp);
                 }
             }
         }
     }
-    else {
-        printf("Out of Case");
-        return;
-    }
+    else if (!trans_stream(M, N, A, B, 0, M, 0))
+        trans_recursive(M, N, A, B, 0, N, 0, M);
 }
 
 /* 
@@ -160,13 +282,645 @@ void trans(int M, int N, int A[N][M], int B[M][N])
 
     for (i = 0; i < N; i++) {
         for (j = 0; j < M; j++) {
-            tmp = A[i][j];
-            B[j][i] = tmp;
+            tmp = LOAD(A[i][j]);
+            STORE(B[j][i], tmp);
         }
     }    
 
 }
 
+#ifdef HAVE_X86_SIMD
+/*
+ * transpose8_avx2 - turn the 8 rows in r into 8 columns: 32-bit and
+ *     64-bit unpacks, then a 128-bit lane permute
+ */
+SIMD_KERNEL("avx2")
+static inline __attribute__((always_inline)) void transpose8_avx2(__m256i* r)
+{
+    /* pairs of rows: a0 b0 a1 b1 | a4 b4 a5 b5 and a2 b2 a3 b3 | a6 b6 a7 b7 */
+    __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+    __m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+    __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+    __m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+    __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+    __m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+    __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+    __m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+    /* quads: a0 b0 c0 d0 | a4 b4 c4 d4 and so on */
+    __m256i q0 = _mm256_unpacklo_epi64(t0, t2);
+    __m256i q1 = _mm256_unpackhi_epi64(t0, t2);
+    __m256i q2 = _mm256_unpacklo_epi64(t1, t3);
+    __m256i q3 = _mm256_unpackhi_epi64(t1, t3);
+    __m256i q4 = _mm256_unpacklo_epi64(t4, t6);
+    __m256i q5 = _mm256_unpackhi_epi64(t4, t6);
+    __m256i q6 = _mm256_unpacklo_epi64(t5, t7);
+    __m256i q7 = _mm256_unpackhi_epi64(t5, t7);
+
+    /* low lanes hold columns 0-3, high lanes columns 4-7 */
+    r[0] = _mm256_permute2x128_si256(q0, q4, 0x20);
+    r[1] = _mm256_permute2x128_si256(q1, q5, 0x20);
+    r[2] = _mm256_permute2x128_si256(q2, q6, 0x20);
+    r[3] = _mm256_permute2x128_si256(q3, q7, 0x20);
+    r[4] = _mm256_permute2x128_si256(q0, q4, 0x31);
+    r[5] = _mm256_permute2x128_si256(q1, q5, 0x31);
+    r[6] = _mm256_permute2x128_si256(q2, q6, 0x31);
+    r[7] = _mm256_permute2x128_si256(q3, q7, 0x31);
+}
+
+/*
+ * block8_avx2 - B[j..j+7][i..i+7] = A[i..i+7][j..j+7]^T in registers.
+ *     The 8 rows of A are loaded before any row of B is stored, so a
+ *     diagonal tile cannot evict its own A rows, and A may be B.
+ */
+SIMD_KERNEL("avx2")
+static void block8_avx2(int M, int N, int A[N][M], int B[M][N], int i, int j)
+{
+    __m256i r[8];
+    int k;
+
+    for (k = 0; k < 8; k++)
+        r[k] = VLOAD256(&A[i+k][j]);
+    transpose8_avx2(r);
+    for (k = 0; k < 8; k++)
+        VSTORE256(&B[j+k][i], r[k]);
+}
+
+/*
+ * swap8_avx2 - in-place transpose of the tile pair X[i][j], X[j][i]:
+ *     both are loaded and transposed in registers, then stored swapped
+ */
+SIMD_KERNEL("avx2")
+static void swap8_avx2(int n, int X[n][n], int i, int j)
+{
+    __m256i p[8], q[8];
+    int k;
+
+    for (k = 0; k < 8; k++) {
+        p[k] = VLOAD256(&X[i+k][j]);
+        q[k] = VLOAD256(&X[j+k][i]);
+    }
+    transpose8_avx2(p);
+    transpose8_avx2(q);
+    for (k = 0; k < 8; k++) {
+        VSTORE256(&X[j+k][i], p[k]);
+        VSTORE256(&X[i+k][j], q[k]);
+    }
+}
+
+/*
+ * stream16x8_avx2 - B[j..j+7][i..i+15] = A[i..i+15][j..j+7]^T with
+ *     non-temporal stores. Two 8x8 tiles give each row of B 16 ints, a
+ *     whole 64-byte line when B is aligned, written back to back so the
+ *     write-combining buffer goes out without reading the line first.
+ *     Rows of B that are not 16-byte aligned go through a staging buffer
+ *     and 4-byte streaming stores.
+ */
+SIMD_KERNEL("avx2")
+static void stream16x8_avx2(int M, int N, int A[N][M], int B[M][N], int i, int j)
+{
+    __m256i lo[8], hi[8];
+    int stage[16] __attribute__((aligned(32)));
+    int k, x;
+
+    for (k = 0; k < 8; k++) {
+        lo[k] = VLOAD256(&A[i+k][j]);
+        hi[k] = VLOAD256(&A[i+8+k][j]);
+    }
+    transpose8_avx2(lo);
+    transpose8_avx2(hi);
+
+    for (k = 0; k < 8; k++) {
+        int* dst = &B[j+k][i];
+        if (!((uintptr_t)dst & 31)) {
+            VSTREAM256(dst, lo[k]);
+            VSTREAM256(dst + 8, hi[k]);
+        }
+        else if (!((uintptr_t)dst & 15)) {
+            VSTREAM128(dst, _mm256_castsi256_si128(lo[k]));
+            VSTREAM128(dst + 4, _mm256_extracti128_si256(lo[k], 1));
+            VSTREAM128(dst + 8, _mm256_castsi256_si128(hi[k]));
+            VSTREAM128(dst + 12, _mm256_extracti128_si256(hi[k], 1));
+        }
+        else {
+            _mm256_store_si256((__m256i*)stage, lo[k]);
+            _mm256_store_si256((__m256i*)(stage + 8), hi[k]);
+            for (x = 0; x < 16; x++)
+                VSTREAM32(dst + x, stage[x]);
+        }
+    }
+}
+
+/*
+ * stream_avx2 - stream16x8_avx2 over rows 0..rows-1, columns c0..c1-1
+ *     (multiples of 16 and 8), one 16-row strip of A at a time so A is
+ *     read a full line per row, then the fence that orders the streaming
+ *     stores before anything after the transpose
+ */
+SIMD_KERNEL("avx2")
+static void stream_avx2(int M, int N, int A[N][M], int B[M][N], int rows, int c0, int c1)
+{
+    int i, j;
+
+    for (i = 0; i < rows; i += 16)
+        for (j = c0; j < c1; j += 8)
+            stream16x8_avx2(M, N, A, B, i, j);
+    _mm_sfence();
+}
+
+/*
+ * block8_sse2 - the same tile as four 4x4 transposes, one row half of
+ *     A at a time
+ */
+SIMD_KERNEL("sse2")
+static void block8_sse2(int M, int N, int A[N][M], int B[M][N], int i, int j)
+{
+    int qi, qj;
+
+    for (qi = i; qi < i + 8; qi += 4) {
+        for (qj = j; qj < j + 8; qj += 4) {
+            __m128i r0 = VLOAD128(&A[qi][qj]);
+            __m128i r1 = VLOAD128(&A[qi+1][qj]);
+            __m128i r2 = VLOAD128(&A[qi+2][qj]);
+            __m128i r3 = VLOAD128(&A[qi+3][qj]);
+            __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+            __m128i t1 = _mm_unpackhi_epi32(r0, r1);
+            __m128i t2 = _mm_unpacklo_epi32(r2, r3);
+            __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+
+            VSTORE128(&B[qj][qi], _mm_unpacklo_epi64(t0, t2));
+            VSTORE128(&B[qj+1][qi], _mm_unpackhi_epi64(t0, t2));
+            VSTORE128(&B[qj+2][qi], _mm_unpacklo_epi64(t1, t3));
+            VSTORE128(&B[qj+3][qi], _mm_unpackhi_epi64(t1, t3));
+        }
+    }
+}
+
+/* 0 scalar, 1 SSE2, 2 AVX2; picked on first use, TRANS_SCALAR forces 0.
+   Not synchronized: trans_parallel picks it before starting threads */
+static int simd_level = -1;
+
+static int select_simd(void)
+{
+    if (simd_level < 0) {
+        simd_level = 0;
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            simd_level = 2;
+        else if (__builtin_cpu_supports("sse2"))
+            simd_level = 1;
+        if (getenv("TRANS_SCALAR"))
+            simd_level = 0;
+    }
+    return simd_level;
+}
+#endif
+
+/*
+ * trans_simd_level - the kernel trans_block8 uses: 0 scalar, 1 SSE2, 2 AVX2
+ */
+int trans_simd_level(void)
+{
+#ifdef HAVE_X86_SIMD
+    return select_simd();
+#else
+    return 0;
+#endif
+}
+
+/*
+ * trans_block8 - transpose the 8x8 tile at A[i][j] with the widest
+ *     kernel this CPU has. Returns 0, having done nothing, when there is
+ *     no SIMD kernel; the caller then runs its scalar code.
+ */
+int trans_block8(int M, int N, int A[N][M], int B[M][N], int i, int j)
+{
+#ifdef HAVE_X86_SIMD
+    switch (select_simd()) {
+    case 2:
+        block8_avx2(M, N, A, B, i, j);
+        return 1;
+    case 1:
+        block8_sse2(M, N, A, B, i, j);
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+/*
+ * trans_swap8 - in-place transpose of the 8x8 tile pair at X[i][j] and
+ *     X[j][i], or of the one diagonal tile when i == j. Needs AVX2 (the
+ *     SSE2 kernel stores before it has read the whole tile); returns 0
+ *     otherwise, like trans_block8.
+ */
+int trans_swap8(int n, int X[n][n], int i, int j)
+{
+#ifdef HAVE_X86_SIMD
+    if (select_simd() == 2) {
+        if (i == j)
+            block8_avx2(n, n, X, X, i, i);
+        else
+            swap8_avx2(n, X, i, j);
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+/*
+ * trans_stream_threshold - the size of B, in bytes, from which
+ *     trans_stream streams unforced; < 0 for never. The default is the
+ *     core's own L2, not the LLC: the LLC is shared and can be hundreds
+ *     of MB, so keyed on it ordinary large matrices never streamed
+ *     although a 4096x4096 transpose streams 5x faster. A B bigger than
+ *     the L2 is not going to be read back from cache by the caller.
+ */
+#define STREAM_MIN_DEFAULT (1LL << 20)
+
+long long trans_stream_min = 0; /* 0: the L2 size; < 0: never stream */
+
+long long trans_stream_threshold(void)
+{
+    long l2;
+
+    if (trans_stream_min)
+        return trans_stream_min;
+    l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    return l2 > 0 ? l2 : STREAM_MIN_DEFAULT;
+}
+
+/*
+ * trans_streams - whether trans_stream streams into B unforced: B is at
+ *     least trans_stream_threshold bytes and its rows start on a 64-byte
+ *     line. With unaligned rows each line is only half written per strip
+ *     and streaming gains nothing. Needs AVX2.
+ */
+int trans_streams(int M, int N, int B[M][N])
+{
+#ifdef HAVE_X86_SIMD
+    long long min = trans_stream_threshold();
+
+    return select_simd() == 2 && min >= 0 && (long long)((size_t)M * N * sizeof(int)) >= min
+        && !(N % 16) && !((uintptr_t)&B[0][0] & 63);
+#else
+    return 0;
+#endif
+}
+
+/*
+ * trans_stream - the non-temporal transpose of columns c0..c1-1 of A
+ *     (c0 a multiple of TILE) when trans_streams says so, or whenever
+ *     `force` is set. Returns 0, having done nothing, when it does not
+ *     apply.
+ */
+int trans_stream(int M, int N, int A[N][M], int B[M][N], int c0, int c1, int force)
+{
+#ifdef HAVE_X86_SIMD
+    int rows = N / 16 * 16;
+    int cols = c0 + (c1 - c0) / 8 * 8;
+
+    if (select_simd() != 2)
+        return 0;
+    if (!force && !trans_streams(M, N, B))
+        return 0;
+
+    stream_avx2(M, N, A, B, rows, c0, cols);
+    if (cols < c1)
+        trans_recursive(M, N, A, B, 0, rows, cols, c1);
+    if (rows < N)
+        trans_recursive(M, N, A, B, rows, N, c0, c1);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * trans_tile - transpose rows r0..r1-1, columns c0..c1-1 of A. A tile on
+ *     the diagonal of a square matrix has A's row and B's row in the same
+ *     set, so the diagonal element is held back until the row is done.
+ */
+void trans_tile(int M, int N, int A[N][M], int B[M][N], int r0, int r1, int c0, int c1)
+{
+    int i, j, tmp = 0;
+
+    if (r1 - r0 == TILE && c1 - c0 == TILE && trans_block8(M, N, A, B, r0, c0))
+        return;
+
+    for (i = r0; i < r1; i++) {
+        for (j = c0; j < c1; j++) {
+            if (i != j)
+                STORE(B[j][i], LOAD(A[i][j]));
+            else
+                tmp = LOAD(A[i][i]);
+        }
+        if (i >= c0 && i < c1)
+            STORE(B[i][i], tmp);
+    }
+}
+
+/*
+ * trans_recursive - cache-oblivious transpose of rows r0..r1-1, columns
+ *     c0..c1-1 of A. Halves the longer side, cut on a TILE boundary so
+ *     the tiles stay block aligned, until the piece is at most TILE x TILE.
+ *     Works for any M x N.
+ */
+void trans_recursive(int M, int N, int A[N][M], int B[M][N], int r0, int r1, int c0, int c1)
+{
+    int half;
+
+    if (r1 - r0 <= TILE && c1 - c0 <= TILE) {
+        trans_tile(M, N, A, B, r0, r1, c0, c1);
+    }
+    else if (r1 - r0 >= c1 - c0) {
+        half = ((r1 - r0) / 2 + TILE - 1) / TILE * TILE;
+        trans_recursive(M, N, A, B, r0, r0 + half, c0, c1);
+        trans_recursive(M, N, A, B, r0 + half, r1, c0, c1);
+    }
+    else {
+        half = ((c1 - c0) / 2 + TILE - 1) / TILE * TILE;
+        trans_recursive(M, N, A, B, r0, r1, c0, c0 + half);
+        trans_recursive(M, N, A, B, r0, r1, c0 + half, c1);
+    }
+}
+
+/*
+ * trans_oblivious - the recursive transpose on its own, for comparing
+ *     against the hand-tuned cases
+ */
+char trans_oblivious_desc[] = "Cache-oblivious recursive transpose";
+void trans_oblivious(int M, int N, int A[N][M], int B[M][N])
+{
+    trans_recursive(M, N, A, B, 0, N, 0, M);
+}
+
+/*
+ * trans_parallel - the recursive (or, past trans_stream_threshold, streaming)
+ *     transpose on trans_threads threads (0 = one per online CPU), or
+ *     on the calling thread alone without -DTRANS_THREADS. Thread t owns
+ *     a contiguous band of B's rows, which is a band of A's columns cut
+ *     on a TILE boundary, so the threads write disjoint stretches of B;
+ *     at most the one line straddling two bands is shared. The calling
+ *     thread takes band 0.
+ *     There is no thread pool: every call creates and joins its threads,
+ *     about 9 us per thread on a one-CPU host (3 threads: 26 us) against
+ *     50 us for a whole 256x256 transpose, so matrices under PARALLEL_MIN
+ *     elements stay on one thread. The speedup on several cores has not
+ *     been measured yet (see trans-bench).
+ */
+#define MAX_THREADS 64
+#define PARALLEL_MIN (1 << 16)
+
+int trans_threads = 0;
+
+typedef struct {
+    int M, N;
+    int* A;
+    int* B;
+    int c0, c1;
+#ifdef HAVE_THREADS
+    int started;
+    pthread_t thread;
+#endif
+} trans_band;
+
+static void* band_main(void* arg)
+{
+    trans_band* band = arg;
+    int M = band->M, N = band->N;
+
+    int (*A)[M] = (int (*)[M])band->A;
+    int (*B)[N] = (int (*)[N])band->B;
+
+    if (!trans_stream(M, N, A, B, band->c0, band->c1, 0))
+        trans_recursive(M, N, A, B, 0, N, band->c0, band->c1);
+    return 0;
+}
+
+char trans_parallel_desc[] = "Multithreaded tiled transpose";
+void trans_parallel(int M, int N, int A[N][M], int B[M][N])
+{
+    trans_band bands[MAX_THREADS];
+    int tiles = (M + TILE - 1) / TILE;
+    int n = trans_threads > 0 ? trans_threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int t;
+
+#ifndef HAVE_THREADS
+    n = 1;
+#endif
+    if (n > MAX_THREADS)
+        n = MAX_THREADS;
+    if (n > tiles)
+        n = tiles;
+    if (n < 1 || (long)M * N < PARALLEL_MIN)
+        n = 1;
+#ifdef HAVE_X86_SIMD
+    select_simd(); /* before any band thread reads simd_level */
+#endif
+
+    for (t = n - 1; t >= 0; t--) {
+        bands[t].M = M;
+        bands[t].N = N;
+        bands[t].A = &A[0][0];
+        bands[t].B = &B[0][0];
+        bands[t].c0 = tiles * t / n * TILE;
+        bands[t].c1 = t == n - 1 ? M : tiles * (t + 1) / n * TILE;
+#ifdef HAVE_THREADS
+        bands[t].started = t && !pthread_create(&bands[t].thread, 0, band_main, &bands[t]);
+        if (!bands[t].started)
+#endif
+            band_main(&bands[t]);
+    }
+
+#ifdef HAVE_THREADS
+    for (t = 1; t < n; t++)
+        if (bands[t].started)
+            pthread_join(bands[t].thread, 0);
+#endif
+}
+
+/*
+ * trans_tuned_for - the tuning table entry for this shape and cache at
+ *     the current SIMD level, or 0
+ */
+const tune_entry* trans_tuned_for(int M, int N, int s, int E, int b)
+{
+    const tune_entry* t;
+    int simd = trans_simd_level();
+
+    if (!trans_use_table)
+        return 0;
+    for (t = tune_table; t->tile; t++)
+        if (t->M == M && t->N == N && t->s == s && t->E == E && t->b == b && t->simd == simd)
+            return t;
+    return 0;
+}
+
+/*
+ * trans_blocked - the tiled transpose the tuner searches over: tile x
+ *     tile blocks, each swept in passes of `sub` columns of A so only
+ *     `sub` rows of B are live at once. diag picks how an element on the
+ *     diagonal is handled, where A's and B's rows share a set:
+ *     DIAG_NONE copies it in place, DIAG_DEFER holds it until the rest
+ *     of the row is stored, DIAG_BUFFER (sub == 8) loads the whole row
+ *     segment of A before storing any of it. Whole 8x8 tiles go to
+ *     trans_block8 instead, when there is a SIMD kernel.
+ */
+void trans_blocked(int M, int N, int A[N][M], int B[M][N], int tile, int sub, int diag)
+{
+    int bi, bj, jj, i, j, end, start, wide_end, tmp = 0;
+    int s0, s1, s2, s3, s4, s5, s6, s7;
+
+    for (bi = 0; bi < N; bi += tile) {
+        for (bj = 0; bj < M; bj += tile) {
+            for (jj = bj; jj < bj + tile && jj < M; jj += sub) {
+                end = jj + sub;
+                if (end > bj + tile)
+                    end = bj + tile;
+                if (end > M)
+                    end = M;
+
+                wide_end = bi;
+                for (i = bi; i < bi + tile && i < N; i++) {
+                    /* 8 rows by every whole 8 columns of the pass, when
+                       they fit the tile, through the SIMD kernel */
+                    if (i >= wide_end && (i - bi) % 8 == 0 && i + 8 <= bi + tile
+                        && i + 8 <= N && end - jj >= 8 && trans_block8(M, N, A, B, i, jj)) {
+                        for (j = jj + 8; j + 8 <= end; j += 8)
+                            trans_block8(M, N, A, B, i, j);
+                        wide_end = i + 8;
+                    }
+                    start = i < wide_end ? jj + (end - jj) / 8 * 8 : jj;
+
+                    if (start == jj && diag == DIAG_BUFFER && end - jj == 8) {
+                        s0 = LOAD(A[i][jj]);
+                        s1 = LOAD(A[i][jj+1]);
+                        s2 = LOAD(A[i][jj+2]);
+                        s3 = LOAD(A[i][jj+3]);
+                        s4 = LOAD(A[i][jj+4]);
+                        s5 = LOAD(A[i][jj+5]);
+                        s6 = LOAD(A[i][jj+6]);
+                        s7 = LOAD(A[i][jj+7]);
+                        STORE(B[jj][i], s0);
+                        STORE(B[jj+1][i], s1);
+                        STORE(B[jj+2][i], s2);
+                        STORE(B[jj+3][i], s3);
+                        STORE(B[jj+4][i], s4);
+                        STORE(B[jj+5][i], s5);
+                        STORE(B[jj+6][i], s6);
+                        STORE(B[jj+7][i], s7);
+                        continue;
+                    }
+                    for (j = start; j < end; j++) {
+                        if (diag != DIAG_NONE && i == j)
+                            tmp = LOAD(A[i][i]);
+                        else
+                            STORE(B[j][i], LOAD(A[i][j]));
+                    }
+                    if (diag != DIAG_NONE && i >= start && i < end)
+                        STORE(B[i][i], tmp);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * trans_streaming - trans_stream whatever the size, for comparing against
+ *     the regular stores of trans_oblivious
+ */
+char trans_streaming_desc[] = "Non-temporal streaming-store transpose";
+void trans_streaming(int M, int N, int A[N][M], int B[M][N])
+{
+    if (!trans_stream(M, N, A, B, 0, M, 1))
+        trans_recursive(M, N, A, B, 0, N, 0, M);
+}
+
+/*
+ * trans_inplace_square - X = X^T for an n x n matrix, one tile pair at a
+ *     time: each off-diagonal pair is swapped, each diagonal tile
+ *     transposed over itself
+ */
+void trans_inplace_square(int n, int X[n][n])
+{
+    int bi, bj, i, j, tmp;
+
+    for (bi = 0; bi < n; bi += TILE) {
+        for (bj = bi; bj < n; bj += TILE) {
+            if (bj + TILE <= n && trans_swap8(n, X, bi, bj))
+                continue;
+            for (i = bi; i < bi + TILE && i < n; i++) {
+                for (j = bi == bj ? i + 1 : bj; j < bj + TILE && j < n; j++) {
+                    tmp = LOAD(X[i][j]);
+                    STORE(X[i][j], LOAD(X[j][i]));
+                    STORE(X[j][i], tmp);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * trans_inplace_cycle - in-place transpose of the N x M row-major matrix
+ *     at X into M x N. The element at index k moves to k * N mod (MN - 1),
+ *     so each cycle of that permutation is rotated by one through a
+ *     single register; a bit per element marks what has moved, 1/32 of
+ *     the matrix. Returns 1, with X untouched, if that is not available.
+ */
+int trans_inplace_cycle(int M, int N, int* X)
+{
+    long long last = (long long)M * N - 1; /* 0 and last stay put */
+    long long start, k;
+    unsigned char* moved;
+    int v, tmp;
+
+    if (last < 2)
+        return 0;
+    if (!(moved = calloc(last / 8 + 1, 1)))
+        return 1;
+
+    for (start = 1; start < last; start++) {
+        if (moved[start >> 3] & (1 << (start & 7)))
+            continue;
+        v = LOAD(X[start]);
+        k = start;
+        do {
+            k = k * N % last;
+            tmp = LOAD(X[k]);
+            STORE(X[k], v);
+            v = tmp;
+            moved[k >> 3] |= 1 << (k & 7);
+        } while (k != start);
+    }
+
+    free(moved);
+    return 0;
+}
+
+/*
+ * trans_inplace - the in-place transposes under the driver's interface:
+ *     A is copied into B's storage, which is then transposed over itself.
+ *     For the host's memory footprint only: on the lab's cache the copy
+ *     and the swaps conflict (9216 misses on 64x64), as its description
+ *     says in the driver's listing.
+ */
+char trans_inplace_desc[] = "In-place transpose (host only, not for the lab cache)";
+void trans_inplace(int M, int N, int A[N][M], int B[M][N])
+{
+    int* X = &B[0][0];
+    int i, j;
+
+    for (i = 0; i < N; i++)
+        for (j = 0; j < M; j++)
+            STORE(X[i * M + j], LOAD(A[i][j]));
+
+    if (M == N)
+        trans_inplace_square(M, B);
+    else if (trans_inplace_cycle(M, N, X))
+        trans_recursive(M, N, A, B, 0, N, 0, M);
+}
+
 /*
  * registerFunctions - This function registers your transpose
  *     functions with the driver.  At runtime, the driver will
@@ -181,6 +935,10 @@ void registerFunctions()
 
     /* Register any additional transpose functions */
     registerTransFunction(trans, trans_desc); 
+    registerTransFunction(trans_oblivious, trans_oblivious_desc);
+    registerTransFunction(trans_parallel, trans_parallel_desc);
+    registerTransFunction(trans_inplace, trans_inplace_desc);
+    registerTransFunction(trans_streaming, trans_streaming_desc);
 
 }
 